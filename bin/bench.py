@@ -0,0 +1,314 @@
+#!/usr/bin/env python3
+"""Throughput benchmark for cachesim.
+
+Generates large synthetic binary traces (once, they are cached between runs),
+runs every policy and geometry over them, and reports accesses/second,
+ns/access and peak RSS. The results are compared against a baseline file, and
+the run fails if any configuration got slower by more than the threshold. The
+baseline is tracked in git (bench/baseline.json), records the host it was
+measured on, and only changes with --update-baseline. Runs on any other host
+refuse to compare against it.
+"""
+
+import argparse
+import bisect
+import itertools
+import json
+import multiprocessing
+import os
+import platform
+import random
+import struct
+import subprocess
+import sys
+from array import array
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+RESULTS_DIR = os.path.join(ROOT, "bench_results")
+BASELINE = os.path.join(ROOT, "bench", "baseline.json")
+
+POLICIES = ["LRU", "RAND", "LRU_PREFER_CLEAN", "PLRU", "SRRIP", "BRRIP"]
+
+# (cache_size, cache_lines, associativity): an L1, an L2 and a highly
+# associative cache that uses the O(1) engine.
+GEOMETRIES = [
+    (32768, 512, 8),
+    (1048576, 16384, 16),
+    (4194304, 65536, 64),
+]
+
+# Matches struct trace_file_header in src/trace.h.
+TRACE_FILE_MAGIC = b"CSIMTRC\0"
+TRACE_FILE_VERSION = 1
+TRACE_RECORD_WRITE = 1
+
+
+def record(address, write):
+    return (address << 1) | (TRACE_RECORD_WRITE if write else 0)
+
+
+def gen_sequential(rng, n):
+    """Several streams walking forwards through large arrays, 8 bytes apart."""
+    streams = [0x10000000 + i * 0x4000000 for i in range(4)]
+    out = array("Q")
+    for i in range(n):
+        s = i % len(streams)
+        out.append(record(streams[s], s == 3))
+        streams[s] += 8
+    return out
+
+
+def gen_strided(rng, n):
+    """Column-order walks over a matrix: every access a new line."""
+    base, rows, stride = 0x20000000, 4096, 4160
+    out = array("Q")
+    col = row = 0
+    for _ in range(n):
+        out.append(record(base + row * stride + col * 8, rng.random() < 0.25))
+        row += 1
+        if row == rows:
+            row, col = 0, (col + 1) % 520
+    return out
+
+
+def gen_uniform(rng, n):
+    """Uniformly random accesses over 256 MiB."""
+    out = array("Q")
+    getrandbits, rand = rng.getrandbits, rng.random
+    for _ in range(n):
+        out.append(record(0x40000000 + (getrandbits(28) & ~7), rand() < 0.3))
+    return out
+
+
+def gen_zipf(rng, n, lines=1 << 20, s=1.0):
+    """Lines drawn from a Zipfian distribution (a small hot set and a long tail)."""
+    cdf = list(itertools.accumulate(1.0 / (k + 1) ** s for k in range(lines)))
+    total = cdf[-1]
+    # Scatter the popularity ranks over the address space.
+    perm = list(range(lines))
+    rng.shuffle(perm)
+    out = array("Q")
+    rand = rng.random
+    for _ in range(n):
+        line = perm[bisect.bisect_left(cdf, rand() * total)]
+        out.append(record(0x80000000 + line * 64 + (rng.getrandbits(3) << 3), rand() < 0.3))
+    return out
+
+
+def gen_stack(rng, n):
+    """Like inputs/trace5: call frames pushed and popped on a stack, with
+    reads of globals and a heap in between."""
+    stack_top = 0x7FFE9BE8E000
+    globals_base, heap_base = 0x5609BB55C000, 0x7FC6FFD00000
+    frames = []
+    sp = stack_top
+    out = array("Q")
+    rand = rng.random
+    while len(out) < n:
+        r = rand()
+        if (r < 0.3 and len(frames) < 200) or not frames:
+            # Call: push a frame and write its slots.
+            size = rng.choice((16, 32, 48, 64, 128, 256))
+            frames.append(size)
+            sp -= size
+            for off in range(0, size, 8):
+                out.append(record(sp + off, True))
+        elif r < 0.55:
+            # Return.
+            sp += frames.pop()
+        elif r < 0.85:
+            # Locals.
+            out.append(record(sp + (rng.getrandbits(5) << 3) % frames[-1], rand() < 0.4))
+        elif r < 0.95:
+            out.append(record(globals_base + (rng.getrandbits(12) << 3), False))
+        else:
+            out.append(record(heap_base + (rng.getrandbits(20) << 3), rand() < 0.2))
+    del out[n:]
+    return out
+
+
+GENERATORS = {
+    "sequential": gen_sequential,
+    "strided": gen_strided,
+    "uniform": gen_uniform,
+    "zipf": gen_zipf,
+    "stack": gen_stack,
+}
+
+
+def trace_path(name, records, seed):
+    return os.path.join(RESULTS_DIR, "traces", "%s-%d-%d.bin" % (name, records, seed))
+
+
+def generate_trace(name, records, seed):
+    path = trace_path(name, records, seed)
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    print("Generating %s trace (%d records)..." % (name, records), file=sys.stderr)
+    data = GENERATORS[name](random.Random(seed), records)
+    if sys.byteorder != "little":
+        data.byteswap()
+    tmp = path + ".tmp"
+    with open(tmp, "wb") as f:
+        f.write(struct.pack("<8sIIQ", TRACE_FILE_MAGIC, TRACE_FILE_VERSION, 8, len(data)))
+        data.tofile(f)
+    os.replace(tmp, path)
+
+
+def host_fingerprint():
+    """The machine the timings were measured on: its architecture, CPU model
+    and number of CPUs."""
+    model = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {"machine": platform.machine(), "cpu": model, "cpus": os.cpu_count()}
+
+
+def describe_host(host):
+    if not host:
+        return "an unrecorded host"
+    return "%s (%s CPUs, %s)" % (host.get("cpu"), host.get("cpus"), host.get("machine"))
+
+
+def run_once(cachesim, trace, policy, geometry):
+    """Returns (CPU seconds, peak RSS in KiB) of one run. CPU time is less
+    sensitive to other load on the machine than wall time."""
+    args = [cachesim, "-v", "quiet", "-t", trace, policy] + [str(g) for g in geometry]
+    proc = subprocess.Popen(args, stdout=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = usage.ru_utime + usage.ru_stime
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        raise RuntimeError("%s exited with %d" % (" ".join(args), proc.returncode))
+    return elapsed, usage.ru_maxrss
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cachesim", default=os.path.join(ROOT, "cachesim"))
+    parser.add_argument("--records", type=int, default=2000000,
+                        help="accesses per synthetic trace (default: %(default)s)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="runs per configuration; the fastest counts (default: %(default)s)")
+    parser.add_argument("--traces", default=",".join(GENERATORS),
+                        help="comma-separated subset of: %(default)s")
+    parser.add_argument("--policies", default=",".join(POLICIES))
+    parser.add_argument("--baseline", default=BASELINE,
+                        help="baseline file (default: bench/baseline.json)")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed throughput regression in percent (default: %(default)s)")
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="save the results as the new baseline")
+    args = parser.parse_args()
+
+    # Without a baseline made from the same traces on the same host there is
+    # nothing to compare against, and a run that cannot be compared must not
+    # pass the gate.
+    host = host_fingerprint()
+    saved = None
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            saved = json.load(f)
+        if saved.get("host") != host:
+            if not args.update_baseline:
+                print("%s: baseline %s was measured on %s, not on this host, %s; run with "
+                      "--update-baseline to make one here, or pass another --baseline"
+                      % (sys.argv[0], args.baseline, describe_host(saved.get("host")),
+                         describe_host(host)), file=sys.stderr)
+                return 2
+            # Results from another host are not kept next to this one's.
+            saved = None
+        elif saved.get("records") != args.records or saved.get("seed") != args.seed:
+            print("%s: baseline %s was made with --records %s --seed %s; remove it to make a "
+                  "baseline with other traces" % (sys.argv[0], args.baseline,
+                                                  saved.get("records"), saved.get("seed")),
+                  file=sys.stderr)
+            return 2
+    elif not args.update_baseline:
+        print("%s: no baseline %s; run with --update-baseline to make one"
+              % (sys.argv[0], args.baseline), file=sys.stderr)
+        return 2
+    baseline = saved["results"] if saved is not None and not args.update_baseline else {}
+
+    traces = args.traces.split(",")
+    policies = args.policies.split(",")
+    paths = {name: trace_path(name, args.records, args.seed) for name in traces}
+    # The peak RSS of a child includes the footprint of this process when it
+    # forked, so the traces are generated in a separate process.
+    missing = [(name, args.records, args.seed) for name in traces if not os.path.exists(paths[name])]
+    if missing:
+        with multiprocessing.get_context("spawn").Pool(len(missing)) as pool:
+            pool.starmap(generate_trace, missing)
+
+    results = {}
+    regressions = []
+    unmeasured = []
+    print("%-10s %-16s %-22s %12s %10s %10s %9s"
+          % ("trace", "policy", "geometry", "accesses/s", "ns/access", "rss_kib", "change"))
+    configs = list(itertools.product(traces, policies, GEOMETRIES))
+    # Every round runs each configuration once, so that a slow spell of the
+    # machine does not hit all runs of the same configuration.
+    runs = {config: [] for config in configs}
+    for _ in range(args.repeat):
+        for name, policy, geometry in configs:
+            runs[name, policy, geometry].append(run_once(args.cachesim, paths[name], policy,
+                                                         geometry))
+    for name, policy, geometry in configs:
+        seconds = min(r[0] for r in runs[name, policy, geometry])
+        rss = max(r[1] for r in runs[name, policy, geometry])
+        key = "%s/%s/%s" % (name, policy, ",".join(str(g) for g in geometry))
+        result = {
+            "accesses_per_second": args.records / seconds,
+            "ns_per_access": seconds * 1e9 / args.records,
+            "peak_rss_kib": rss,
+        }
+        results[key] = result
+
+        change = ""
+        if not args.update_baseline and key not in baseline:
+            unmeasured.append(key)
+            change = "new !"
+        elif key in baseline:
+            ratio = result["accesses_per_second"] / baseline[key]["accesses_per_second"]
+            change = "%+.1f%%" % ((ratio - 1) * 100)
+            if ratio < 1 - args.threshold / 100:
+                regressions.append((key, change))
+                change += " !"
+        print("%-10s %-16s %-22s %12.0f %10.2f %10d %9s"
+              % (name, policy, ",".join(str(g) for g in geometry),
+                 result["accesses_per_second"], result["ns_per_access"], rss, change))
+
+    if args.update_baseline:
+        # Configurations that were not run keep their previous results.
+        saved_results = saved["results"] if saved is not None else {}
+        saved_results.update(results)
+        os.makedirs(os.path.dirname(os.path.abspath(args.baseline)), exist_ok=True)
+        with open(args.baseline, "w") as f:
+            json.dump({"host": host, "records": args.records, "seed": args.seed,
+                       "results": saved_results}, f, indent=2, sort_keys=True)
+        print("Saved the baseline to %s" % args.baseline)
+
+    status = 0
+    if unmeasured:
+        print("\n%d configuration(s) are not in the baseline; run with --update-baseline:"
+              % len(unmeasured))
+        for key in unmeasured:
+            print("  %s" % key)
+        status = 1
+    if regressions:
+        print("\n%d configuration(s) regressed by more than %g%%:"
+              % (len(regressions), args.threshold))
+        for key, change in regressions:
+            print("  %s %s" % (key, change))
+        status = 1
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,144 @@
+//
+// This file defines the template of the fused access kernels: loops that
+// perform a batch of trace records for one replacement policy at one
+// associativity that is known at compile time.
+//
+// The generic access path (cache_system_mem_access) reads the geometry from
+// the cache system on every access, scans the set once for the tag and again
+// for an invalid way, and calls the policy through its function pointers,
+// which look the line up once more. A kernel instead keeps the geometry in
+// registers, finds the line and the first invalid way in a single unrolled
+// pass over the set, and updates the policy's state inline for the way it
+// found. It is only used where the generic path would do nothing else (see
+// access_kernel_usable), and gives exactly the same results.
+//
+// A policy provides two inline functions for its kernels:
+//
+//      void <prefix>_touch(data_type *data, uint32_t set_idx, uint32_t way,
+//                          uint32_t ways);
+//      uint32_t <prefix>_victim(data_type *data, uint32_t set_idx,
+//                               const uint8_t *set_states, uint32_t ways);
+//
+// touch does what cache_access does once it found the way, and victim what
+// eviction_index does. ACCESS_KERNELS(prefix, data_type) then defines the
+// table <prefix>_kernels of kernels for every associativity up to
+// 1 << (ACCESS_KERNEL_COUNT - 1), from which access_kernel_select picks one
+// when the policy is constructed.
+//
+
+#ifndef ACCESS_KERNEL_H
+#define ACCESS_KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory_system.h"
+#include "replacement_policies.h"
+#include "trace.h"
+
+// Kernels exist for the associativities 1, 2, 4, ..., 1 << (ACCESS_KERNEL_COUNT
+// - 1). Higher ones find their lines through the way index anyway.
+#define ACCESS_KERNEL_COUNT 5
+
+typedef int (*access_kernel)(struct replacement_policy *replacement_policy,
+                             struct cache_system *cache_system, const uint64_t *records,
+                             size_t count);
+
+// The kernel for the associativity, or NULL if there is none or the
+// CACHESIM_ACCESS_KERNELS environment variable is "generic" (for example, to
+// compare their speed).
+static inline access_kernel access_kernel_select(const access_kernel *kernels,
+                                                 uint32_t associativity)
+{
+    const char *choice = getenv("CACHESIM_ACCESS_KERNELS");
+    if (choice != NULL && !strcmp(choice, "generic")) return NULL;
+    for (uint32_t i = 0; i < ACCESS_KERNEL_COUNT; i++) {
+        if (associativity == 1u << i) return kernels[i];
+    }
+    return NULL;
+}
+
+// Whether a kernel can perform the accesses of the cache system: it only
+// handles flat tag arrays searched directly, and no per-access output,
+// instrumentation, or sampling.
+static inline bool access_kernel_usable(const struct cache_system *cache_system)
+{
+    return cache_system->sparse == NULL && cache_system->way_index == NULL &&
+           cache_system->instrumentation == NULL && cache_system->sampling == NULL &&
+           !cache_system_tracing(cache_system);
+}
+
+#define ACCESS_KERNEL(name, ways, data_type, prefix)                                              \
+    static int name(struct replacement_policy *replacement_policy,                                \
+                    struct cache_system *cache_system, const uint64_t *records, size_t count)     \
+    {                                                                                             \
+        data_type *data = (data_type *)replacement_policy->data;                                  \
+        const uint64_t set_index_mask = cache_system->set_index_mask;                             \
+        const uint32_t offset_bits = cache_system->offset_bits;                                   \
+        const uint32_t tag_shift = offset_bits + cache_system->index_bits;                        \
+        uint64_t *tags = cache_system->tags;                                                      \
+        uint8_t *states = cache_system->states;                                                   \
+        uint64_t hits = 0, dirty_evictions = 0, fills = 0;                                        \
+                                                                                                  \
+        for (size_t i = 0; i < count; i++) {                                                      \
+            if (i + CACHE_SYSTEM_PREFETCH_DISTANCE < count) {                                     \
+                uint64_t ahead = records[i + CACHE_SYSTEM_PREFETCH_DISTANCE];                     \
+                uint32_t ahead_set =                                                              \
+                    (trace_record_address(ahead) & set_index_mask) >> offset_bits;                \
+                __builtin_prefetch(&tags[(size_t)ahead_set * (ways)]);                            \
+            }                                                                                     \
+            uint64_t address = trace_record_address(records[i]);                                  \
+            bool write = records[i] & TRACE_RECORD_WRITE;                                         \
+            uint32_t set_idx = (address & set_index_mask) >> offset_bits;                         \
+            uint64_t tag = address >> tag_shift;                                                  \
+            uint64_t *set_tags = &tags[(size_t)set_idx * (ways)];                                 \
+            uint8_t *set_states = &states[(size_t)set_idx * (ways)];                              \
+                                                                                                  \
+            /* One unrolled pass finds the line and the first invalid way. */                     \
+            uint32_t found = 0, invalid = 0;                                                      \
+            _Pragma("GCC unroll 16") for (uint32_t w = 0; w < (ways); w++) {                      \
+                found |= (uint32_t)(set_tags[w] == tag) << w;                                     \
+                invalid |= (uint32_t)(set_tags[w] == CACHE_TAG_INVALID) << w;                     \
+            }                                                                                     \
+                                                                                                  \
+            uint32_t way;                                                                         \
+            if (found) {                                                                          \
+                way = __builtin_ctz(found);                                                       \
+                hits++;                                                                           \
+                if (write) set_states[way] = MODIFIED;                                            \
+            } else {                                                                              \
+                if (invalid) {                                                                    \
+                    way = __builtin_ctz(invalid);                                                 \
+                    fills++;                                                                      \
+                } else {                                                                          \
+                    way = prefix##_victim(data, set_idx, set_states, (ways));                     \
+                    dirty_evictions += set_states[way] == MODIFIED;                               \
+                }                                                                                 \
+                set_tags[way] = tag;                                                              \
+                set_states[way] = write ? MODIFIED : EXCLUSIVE;                                   \
+            }                                                                                     \
+            prefix##_touch(data, set_idx, way, (ways));                                           \
+        }                                                                                         \
+                                                                                                  \
+        cache_system->stats.accesses += count;                                                    \
+        cache_system->stats.hits += hits;                                                         \
+        cache_system->stats.misses += count - hits;                                               \
+        cache_system->stats.dirty_evictions += dirty_evictions;                                   \
+        cache_system->valid_lines += fills;                                                       \
+        return 0;                                                                                 \
+    }
+
+#define ACCESS_KERNELS(prefix, data_type)                                                         \
+    ACCESS_KERNEL(prefix##_kernel_1, 1, data_type, prefix)                                        \
+    ACCESS_KERNEL(prefix##_kernel_2, 2, data_type, prefix)                                        \
+    ACCESS_KERNEL(prefix##_kernel_4, 4, data_type, prefix)                                        \
+    ACCESS_KERNEL(prefix##_kernel_8, 8, data_type, prefix)                                        \
+    ACCESS_KERNEL(prefix##_kernel_16, 16, data_type, prefix)                                      \
+    static const access_kernel prefix##_kernels[ACCESS_KERNEL_COUNT] = {                          \
+        prefix##_kernel_1, prefix##_kernel_2, prefix##_kernel_4,                                  \
+        prefix##_kernel_8, prefix##_kernel_16,                                                    \
+    };
+
+#endif
@@ -0,0 +1,211 @@
+//
+// This file contains the implementations for the functions defined in
+// checkpoint.h.
+//
+
+#include "checkpoint.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "way_index.h"
+
+// The size of the tags and states of cache_system, padded to 8 bytes.
+static size_t checkpoint_lines_size(const struct cache_system *cache_system)
+{
+    size_t num_lines = (size_t)cache_system->num_sets * cache_system->associativity;
+    return (num_lines * (sizeof(uint64_t) + sizeof(uint8_t)) + 7) & ~(size_t)7;
+}
+
+int checkpoint_save(const struct cache_system *cache_system, const char *policy,
+                    uint64_t position, const char *path)
+{
+    struct checkpoint_header header = {.magic = CHECKPOINT_FILE_MAGIC};
+    if (strlen(policy) >= sizeof(header.policy)) {
+        fprintf(stderr, "Policy name %s is too long for a checkpoint\n", policy);
+        return 1;
+    }
+
+    size_t path_length = strlen(path);
+    char *tmp_path = malloc(path_length + 5);
+    memcpy(tmp_path, path, path_length);
+    memcpy(tmp_path + path_length, ".tmp", 5);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "%s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return 1;
+    }
+
+    // The header is written again once the size of the policy state is known.
+    fwrite(&header, sizeof(header), 1, out);
+
+    size_t num_lines = (size_t)cache_system->num_sets * cache_system->associativity;
+    static const uint8_t padding[8];
+    size_t padding_size =
+        checkpoint_lines_size(cache_system) - num_lines * (sizeof(uint64_t) + sizeof(uint8_t));
+    for (uint32_t set_idx = 0; set_idx < cache_system->num_sets; set_idx++) {
+        fwrite(cache_system_set_tags(cache_system, set_idx), sizeof(uint64_t),
+               cache_system->associativity, out);
+    }
+    for (uint32_t set_idx = 0; set_idx < cache_system->num_sets; set_idx++) {
+        fwrite(cache_system_set_states(cache_system, set_idx), sizeof(uint8_t),
+               cache_system->associativity, out);
+    }
+    fwrite(padding, 1, padding_size, out);
+
+    struct replacement_policy *rp = cache_system->replacement_policy;
+    long policy_start = ftell(out);
+    int status = rp->serialize != NULL ? rp->serialize(rp, out) : 0;
+    long policy_end = ftell(out);
+
+    header.version = htole32(CHECKPOINT_FILE_VERSION);
+    header.line_size = htole32(cache_system->line_size);
+    header.sets = htole32(cache_system->num_sets);
+    header.associativity = htole32(cache_system->associativity);
+    strcpy(header.policy, policy);
+    header.indexed = htole32(cache_system->way_index != NULL);
+    header.position = htole64(position);
+    header.accesses = htole64(cache_system->stats.accesses);
+    header.hits = htole64(cache_system->stats.hits);
+    header.misses = htole64(cache_system->stats.misses);
+    header.dirty_evictions = htole64(cache_system->stats.dirty_evictions);
+    header.policy_size = htole64(policy_end - policy_start);
+    if (status != 0 || policy_start < 0 || policy_end < 0 || fseek(out, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, out) != 1 || fclose(out) != 0 ||
+        rename(tmp_path, path) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+        free(tmp_path);
+        return 1;
+    }
+    free(tmp_path);
+    return 0;
+}
+
+// Check that the header of a checkpoint of size bytes matches cache_system.
+static int checkpoint_check(const struct checkpoint_header *header, size_t size,
+                            const struct cache_system *cache_system, const char *policy,
+                            const char *path)
+{
+    if (memcmp(header->magic, CHECKPOINT_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        return 1;
+    }
+    if (le32toh(header->version) != CHECKPOINT_FILE_VERSION) {
+        fprintf(stderr, "%s: unsupported checkpoint version %u\n", path,
+                le32toh(header->version));
+        return 1;
+    }
+    if (le32toh(header->line_size) != cache_system->line_size ||
+        le32toh(header->sets) != cache_system->num_sets ||
+        le32toh(header->associativity) != cache_system->associativity ||
+        strncmp(header->policy, policy, sizeof(header->policy)) != 0) {
+        fprintf(stderr,
+                "%s: the checkpoint is of a %.*s cache with %u-byte lines, %u sets and "
+                "associativity %u\n",
+                path, (int)sizeof(header->policy), header->policy, le32toh(header->line_size),
+                le32toh(header->sets), le32toh(header->associativity));
+        return 1;
+    }
+    if (le32toh(header->indexed) != (cache_system->way_index != NULL)) {
+        fprintf(stderr,
+                "%s: the checkpoint was made with a different CACHESIM_HIGH_ASSOCIATIVITY\n",
+                path);
+        return 1;
+    }
+    if (size != sizeof(*header) + checkpoint_lines_size(cache_system) +
+                    le64toh(header->policy_size)) {
+        fprintf(stderr, "%s: the checkpoint is truncated or corrupt\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int checkpoint_restore(struct cache_system *cache_system, const char *policy, const char *path,
+                       uint64_t *position)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(struct checkpoint_header)) {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        close(fd);
+        return 1;
+    }
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    struct checkpoint_header header;
+    memcpy(&header, data, sizeof(header));
+    if (checkpoint_check(&header, size, cache_system, policy, path) != 0) {
+        munmap((void *)data, size);
+        return 1;
+    }
+
+    // Only the sets with valid lines are copied (the others are already
+    // empty), so that sparse storage stays sparse.
+    uint32_t associativity = cache_system->associativity;
+    size_t num_lines = (size_t)cache_system->num_sets * associativity;
+    const uint8_t *lines = data + sizeof(header);
+    cache_system->valid_lines = 0;
+    for (uint32_t set_idx = 0; set_idx < cache_system->num_sets; set_idx++) {
+        const uint8_t *tags = lines + (size_t)set_idx * associativity * sizeof(uint64_t);
+        uint32_t valid = 0;
+        for (uint32_t way = 0; way < associativity; way++) {
+            uint64_t tag;
+            memcpy(&tag, tags + way * sizeof(uint64_t), sizeof(tag));
+            valid += tag != CACHE_TAG_INVALID;
+        }
+        if (valid == 0) continue;
+        cache_system_touch_set(cache_system, set_idx);
+        memcpy(cache_system_set_tags(cache_system, set_idx), tags,
+               associativity * sizeof(uint64_t));
+        memcpy(cache_system_set_states(cache_system, set_idx),
+               lines + num_lines * sizeof(uint64_t) + (size_t)set_idx * associativity,
+               associativity);
+        cache_system->valid_lines += valid;
+    }
+    if (cache_system->way_index != NULL) {
+        way_index_rebuild(cache_system->way_index, cache_system);
+    }
+
+    struct replacement_policy *rp = cache_system->replacement_policy;
+    size_t policy_size = le64toh(header.policy_size);
+    const uint8_t *policy_state = lines + checkpoint_lines_size(cache_system);
+    int status = 0;
+    if (rp->restore != NULL) {
+        status = rp->restore(rp, policy_state, policy_size);
+    } else if (policy_size != 0) {
+        status = 1;
+    }
+    munmap((void *)data, size);
+    if (status != 0) {
+        fprintf(stderr, "%s: the replacement policy state does not match\n", path);
+        return 1;
+    }
+
+    cache_system->stats.accesses = le64toh(header.accesses);
+    cache_system->stats.hits = le64toh(header.hits);
+    cache_system->stats.misses = le64toh(header.misses);
+    cache_system->stats.dirty_evictions = le64toh(header.dirty_evictions);
+    *position = le64toh(header.position);
+    return 0;
+}
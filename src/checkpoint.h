@@ -0,0 +1,54 @@
+//
+// This file defines checkpoints, which save the complete state of a cache
+// system (its lines, statistics and replacement policy state) together with
+// the number of trace records simulated so far, so that a simulation can be
+// continued later: to resume a long run, or to start many experiments from
+// one warmed-up cache.
+//
+// A checkpoint file is a struct checkpoint_header followed by the tags of
+// every line, their states, padding to a multiple of 8 bytes, and policy_size
+// bytes written by the policy's serialize hook. The header fields are
+// little-endian; like binary traces, the arrays are only portable between
+// machines of the same byte order. Restoring maps the file and copies the
+// sections into a cache system built with the same policy and geometry.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "memory_system.h"
+
+#define CHECKPOINT_FILE_MAGIC "CSIMCKP"
+// Version 2 stores the OPT heaps relative to the identity permutation.
+#define CHECKPOINT_FILE_VERSION 2
+
+struct checkpoint_header {
+    char magic[8];     // CHECKPOINT_FILE_MAGIC, NUL-padded
+    uint32_t version;  // CHECKPOINT_FILE_VERSION
+    uint32_t line_size;
+    uint32_t sets;
+    uint32_t associativity;
+    char policy[24];   // The policy name, NUL-padded
+    uint32_t indexed;  // Whether the cache used the high-associativity structures
+    uint32_t reserved;
+    uint64_t position; // The number of trace records simulated
+    uint64_t accesses, hits, misses, dirty_evictions;
+    uint64_t policy_size;
+};
+
+// Save cache_system, which runs the named policy and has simulated the first
+// position records of its trace, to path. The file is written under a
+// temporary name and then renamed, so an existing checkpoint at path is only
+// replaced by a complete one. Returns 0 on success.
+int checkpoint_save(const struct cache_system *cache_system, const char *policy,
+                    uint64_t position, const char *path);
+
+// Load the checkpoint at path into cache_system, which must be newly created
+// with the same policy and geometry, and store the number of trace records it
+// had simulated in *position. Returns 0 on success.
+int checkpoint_restore(struct cache_system *cache_system, const char *policy, const char *path,
+                       uint64_t *position);
+
+#endif
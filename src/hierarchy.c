@@ -0,0 +1,501 @@
+//
+// This file contains the implementation of the multi-level hierarchy mode
+// defined in hierarchy.h.
+//
+// Every level is described on the command line as
+// "policy,cache_size,cache_lines,associativity,latency", from L1 down. The
+// latency is the number of cycles a request that reaches the level waits for
+// it; AMAT adds up the latencies of the levels (and memory) that each demand
+// access visits.
+//
+
+#include "hierarchy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory_system.h"
+#include "replacement_policies.h"
+#include "trace.h"
+
+// The number of requests a level buffers for the next one before handing them
+// down, in a non-inclusive, non-exclusive hierarchy.
+#define HIERARCHY_BATCH_SIZE 4096
+
+// The default number of cycles a request to memory takes.
+#define HIERARCHY_MEMORY_LATENCY 100
+
+enum hierarchy_inclusion {
+    INCLUSION_NINE,
+    INCLUSION_INCLUSIVE,
+    INCLUSION_EXCLUSIVE,
+};
+
+struct hierarchy_level {
+    const char *policy;
+    size_t cache_size, cache_lines, associativity;
+    uint32_t latency;
+    struct cache_system *cache_system;
+
+    // Accesses that a demand request (from the trace or a miss above) waited
+    // for, as opposed to writebacks.
+    uint64_t demand_accesses;
+
+    // Lines invalidated because a lower level evicted them (inclusive only).
+    uint64_t back_invalidations;
+
+    // The requests for the next level (misses as reads and writebacks as
+    // writes), as packed trace records.
+    uint64_t *requests;
+    size_t num_requests;
+};
+
+struct hierarchy {
+    struct hierarchy_level *levels;
+    unsigned num_levels;
+    enum hierarchy_inclusion inclusion;
+
+    // A level hands its requests down once it has this many.
+    size_t flush_threshold;
+
+    uint32_t memory_latency;
+    uint64_t memory_reads, memory_writes;
+};
+
+static void hierarchy_usage(void)
+{
+    fprintf(stderr, "Usage: cachesim hierarchy [-v quiet|summary] [-t trace_file] "
+                    "[-i nine|inclusive|exclusive] [-m memory_latency] [-S seed]\n"
+                    "                          <policy,cache_size,cache_lines,associativity,"
+                    "latency> ...  (L1 first)\n");
+}
+
+static bool is_power_of_two(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// Parse one level description and create its cache system, whose RAND policy
+// uses the given seed. Returns 0 on success.
+static int hierarchy_level_init(struct hierarchy_level *level, char *spec, uint64_t seed)
+{
+    char *fields[6];
+    int num_fields = 0;
+    for (char *save, *field = strtok_r(spec, ",", &save); field != NULL && num_fields < 6;
+         field = strtok_r(NULL, ",", &save)) {
+        fields[num_fields++] = field;
+    }
+    if (num_fields != 5) {
+        fprintf(stderr, "A level needs a policy, cache size, cache line count, associativity, "
+                        "and latency.\n");
+        return 1;
+    }
+    level->policy = fields[0];
+    level->cache_size = strtoul(fields[1], NULL, 10);
+    level->cache_lines = strtoul(fields[2], NULL, 10);
+    level->associativity = strtoul(fields[3], NULL, 10);
+    level->latency = strtoul(fields[4], NULL, 10);
+
+    if (level->cache_lines == 0 || level->associativity == 0 ||
+        level->cache_size % level->cache_lines != 0 ||
+        level->cache_lines % level->associativity != 0 ||
+        !is_power_of_two(level->cache_size / level->cache_lines) ||
+        !is_power_of_two(level->cache_lines / level->associativity)) {
+        fprintf(stderr, "Invalid cache geometry %zu %zu %zu\n", level->cache_size,
+                level->cache_lines, level->associativity);
+        return 1;
+    }
+    uint32_t line_size = level->cache_size / level->cache_lines;
+    uint32_t sets = level->cache_lines / level->associativity;
+
+    level->cache_system = cache_system_new(line_size, sets, level->associativity);
+    if (level->cache_system == NULL) {
+        return 1;
+    }
+    level->cache_system->replacement_policy =
+        replacement_policy_new(level->policy, sets, level->associativity, seed);
+    if (level->cache_system->replacement_policy == NULL) {
+        fprintf(stderr, "Unknown replacement policy %s\n", level->policy);
+        cache_system_cleanup(level->cache_system);
+        free(level->cache_system);
+        level->cache_system = NULL;
+        return 1;
+    }
+    level->requests = malloc(HIERARCHY_BATCH_SIZE * sizeof(uint64_t));
+    return 0;
+}
+
+static int hierarchy_feed(struct hierarchy *hierarchy, unsigned i, const uint64_t *records,
+                          size_t count);
+
+// Hand the buffered requests of level i to the level below it (or memory).
+static int hierarchy_flush(struct hierarchy *hierarchy, unsigned i)
+{
+    struct hierarchy_level *level = &hierarchy->levels[i];
+    size_t count = level->num_requests;
+    level->num_requests = 0;
+
+    if (i + 1 == hierarchy->num_levels) {
+        for (size_t r = 0; r < count; r++) {
+            if (trace_record_rw(level->requests[r]) == 'W') {
+                hierarchy->memory_writes++;
+            } else {
+                hierarchy->memory_reads++;
+            }
+        }
+        return 0;
+    }
+    return hierarchy_feed(hierarchy, i + 1, level->requests, count);
+}
+
+// Invalidate the line at address (which is line_size bytes long) in every
+// level above level i. Returns whether any of the invalidated copies was
+// dirty.
+static bool hierarchy_back_invalidate(struct hierarchy *hierarchy, unsigned i, uint64_t address,
+                                      uint32_t line_size)
+{
+    bool dirty = false;
+    for (unsigned j = 0; j < i; j++) {
+        struct hierarchy_level *upper = &hierarchy->levels[j];
+        uint32_t upper_line_size = upper->cache_system->line_size;
+        for (uint64_t a = address; a < address + line_size; a += upper_line_size) {
+            enum cache_status state = cache_system_invalidate(upper->cache_system, a);
+            if (state != INVALID) upper->back_invalidations++;
+            if (state == MODIFIED) dirty = true;
+        }
+    }
+    return dirty;
+}
+
+// Add a request for the size bytes at address to the buffer of level i. The
+// request is split into one per line of the next level, so that a level with
+// larger lines than the one below it fetches and writes back all of them.
+static int hierarchy_request(struct hierarchy *hierarchy, unsigned i, uint64_t address,
+                             uint32_t size, char rw)
+{
+    struct hierarchy_level *level = &hierarchy->levels[i];
+    uint32_t step = size;
+    if (i + 1 < hierarchy->num_levels && hierarchy->levels[i + 1].cache_system->line_size < size) {
+        step = hierarchy->levels[i + 1].cache_system->line_size;
+    }
+    for (uint64_t a = address; a < address + size; a += step) {
+        level->requests[level->num_requests++] = trace_record_pack(a, rw);
+        if (level->num_requests == HIERARCHY_BATCH_SIZE && hierarchy_flush(hierarchy, i) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Simulate the requests in records on level i of a non-exclusive hierarchy,
+// handing its own requests down as they accumulate.
+static int hierarchy_feed(struct hierarchy *hierarchy, unsigned i, const uint64_t *records,
+                          size_t count)
+{
+    struct hierarchy_level *level = &hierarchy->levels[i];
+    struct cache_system *cache_system = level->cache_system;
+    uint64_t line_mask = ~cache_system->offset_mask;
+
+    // A writeback from the level above that covers a whole line of this
+    // level replaces the line, so a miss allocates it without a fetch. One
+    // that covers only part of a line is written through to the next level
+    // when it misses, rather than fetching the rest of the line.
+    bool full_line_writebacks =
+        i > 0 && hierarchy->levels[i - 1].cache_system->line_size >= cache_system->line_size;
+
+    for (size_t r = 0; r < count; r++) {
+        uint64_t address = trace_record_address(records[r]);
+        char rw = trace_record_rw(records[r]);
+        bool writeback = i > 0 && rw == 'W';
+        if (!writeback) level->demand_accesses++;
+
+        if (writeback && !full_line_writebacks) {
+            uint32_t set_idx =
+                (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+            uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+            if (cache_system_find_way(cache_system, set_idx, tag) < 0) {
+                cache_system->stats.accesses++;
+                cache_system->stats.misses++;
+                if (hierarchy_request(hierarchy, i, address,
+                                      hierarchy->levels[i - 1].cache_system->line_size,
+                                      'W') != 0) {
+                    return 1;
+                }
+                if (level->num_requests >= hierarchy->flush_threshold &&
+                    hierarchy_flush(hierarchy, i) != 0) {
+                    return 1;
+                }
+                continue;
+            }
+        }
+
+        struct cache_system_outcome outcome;
+        if (cache_system_mem_access_outcome(cache_system, address, rw, &outcome) != 0) {
+            return 1;
+        }
+
+        if (outcome.evicted_state != INVALID) {
+            bool dirty = outcome.evicted_state == MODIFIED;
+            if (hierarchy->inclusion == INCLUSION_INCLUSIVE &&
+                hierarchy_back_invalidate(hierarchy, i, outcome.evicted_address,
+                                          cache_system->line_size) &&
+                !dirty) {
+                // The line was clean here but dirty above, so its eviction
+                // from this level still needs a writeback.
+                cache_system->stats.dirty_evictions++;
+                dirty = true;
+            }
+            if (dirty && hierarchy_request(hierarchy, i, outcome.evicted_address,
+                                           cache_system->line_size, 'W') != 0) {
+                return 1;
+            }
+        }
+        if (!outcome.hit && !writeback &&
+            hierarchy_request(hierarchy, i, address & line_mask, cache_system->line_size,
+                              'R') != 0) {
+            return 1;
+        }
+
+        if (level->num_requests >= hierarchy->flush_threshold &&
+            hierarchy_flush(hierarchy, i) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Take the line at address out of the first level from i down that holds it
+// (or memory). *dirty is set to whether the line was dirty there.
+static void exclusive_fetch(struct hierarchy *hierarchy, unsigned i, uint64_t address,
+                            bool *dirty)
+{
+    for (; i < hierarchy->num_levels; i++) {
+        struct hierarchy_level *level = &hierarchy->levels[i];
+        struct cache_system_stats *stats = &level->cache_system->stats;
+        level->demand_accesses++;
+        stats->accesses++;
+
+        enum cache_status state = cache_system_invalidate(level->cache_system, address);
+        if (state != INVALID) {
+            stats->hits++;
+            *dirty = state == MODIFIED;
+            return;
+        }
+        stats->misses++;
+    }
+    hierarchy->memory_reads++;
+    *dirty = false;
+}
+
+// Place a line evicted from level i - 1 in level i, moving whatever it evicts
+// further down.
+static int exclusive_insert(struct hierarchy *hierarchy, unsigned i, uint64_t address, bool dirty)
+{
+    for (; i < hierarchy->num_levels; i++) {
+        struct cache_system_outcome outcome;
+        if (cache_system_insert(hierarchy->levels[i].cache_system, address, dirty, &outcome) != 0) {
+            return 1;
+        }
+        if (outcome.evicted_state == INVALID) return 0;
+        address = outcome.evicted_address;
+        dirty = outcome.evicted_state == MODIFIED;
+    }
+    if (dirty) hierarchy->memory_writes++;
+    return 0;
+}
+
+// Simulate one access from the trace on an exclusive hierarchy.
+static int exclusive_access(struct hierarchy *hierarchy, uint64_t address, char rw)
+{
+    struct hierarchy_level *l1 = &hierarchy->levels[0];
+    struct cache_system *cache_system = l1->cache_system;
+    l1->demand_accesses++;
+
+    // On a miss, the line is fetched from below first, so that a dirty line
+    // moving up is filled as dirty.
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    if (cache_system_find_way(cache_system, set_idx, tag) < 0) {
+        bool dirty;
+        exclusive_fetch(hierarchy, 1, address, &dirty);
+        if (dirty) rw = 'W';
+    }
+
+    struct cache_system_outcome outcome;
+    if (cache_system_mem_access_outcome(cache_system, address, rw, &outcome) != 0) {
+        return 1;
+    }
+    if (outcome.evicted_state != INVALID) {
+        return exclusive_insert(hierarchy, 1, outcome.evicted_address,
+                                outcome.evicted_state == MODIFIED);
+    }
+    return 0;
+}
+
+static void hierarchy_print(const struct hierarchy *hierarchy)
+{
+    uint64_t cycles = hierarchy->memory_reads * hierarchy->memory_latency;
+    for (unsigned i = 0; i < hierarchy->num_levels; i++) {
+        const struct hierarchy_level *level = &hierarchy->levels[i];
+        const struct cache_system_stats *stats = &level->cache_system->stats;
+        printf("OUTPUT L%u ACCESSES %" PRIu64 "\n", i + 1, stats->accesses);
+        printf("OUTPUT L%u HITS %" PRIu64 "\n", i + 1, stats->hits);
+        printf("OUTPUT L%u MISSES %" PRIu64 "\n", i + 1, stats->misses);
+        printf("OUTPUT L%u DIRTY EVICTIONS %" PRIu64 "\n", i + 1, stats->dirty_evictions);
+        printf("OUTPUT L%u HIT RATIO %.8f\n", i + 1,
+               stats->accesses ? (double)stats->hits / stats->accesses : 0.0);
+        if (hierarchy->inclusion == INCLUSION_INCLUSIVE && i + 1 < hierarchy->num_levels) {
+            printf("OUTPUT L%u BACK INVALIDATIONS %" PRIu64 "\n", i + 1,
+                   level->back_invalidations);
+        }
+        cycles += level->demand_accesses * level->latency;
+    }
+    printf("OUTPUT MEMORY READS %" PRIu64 "\n", hierarchy->memory_reads);
+    printf("OUTPUT MEMORY WRITES %" PRIu64 "\n", hierarchy->memory_writes);
+
+    uint64_t accesses = hierarchy->levels[0].demand_accesses;
+    printf("OUTPUT AMAT %.4f\n", accesses ? (double)cycles / accesses : 0.0);
+}
+
+int hierarchy_main(int argc, char **argv)
+{
+    struct hierarchy hierarchy = {0};
+    hierarchy.memory_latency = HIERARCHY_MEMORY_LATENCY;
+    enum cache_system_verbosity verbosity = VERBOSITY_SUMMARY;
+    const char *trace_path = NULL;
+    uint64_t seed = REPLACEMENT_POLICY_DEFAULT_SEED;
+    int ret = 1;
+
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "hv:t:i:m:S:")) != -1) {
+        switch (opt) {
+        case 'h':
+            hierarchy_usage();
+            return 0;
+        case 'v':
+            if (!strcmp("quiet", optarg)) {
+                verbosity = VERBOSITY_QUIET;
+            } else if (!strcmp("summary", optarg)) {
+                verbosity = VERBOSITY_SUMMARY;
+            } else {
+                fprintf(stderr, "Unknown verbosity %s (the hierarchy supports quiet and "
+                                "summary)\n",
+                        optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'i':
+            if (!strcmp("nine", optarg)) {
+                hierarchy.inclusion = INCLUSION_NINE;
+            } else if (!strcmp("inclusive", optarg)) {
+                hierarchy.inclusion = INCLUSION_INCLUSIVE;
+            } else if (!strcmp("exclusive", optarg)) {
+                hierarchy.inclusion = INCLUSION_EXCLUSIVE;
+            } else {
+                fprintf(stderr, "Unknown inclusion policy %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            hierarchy.memory_latency = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            hierarchy_usage();
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        hierarchy_usage();
+        return 1;
+    }
+
+    hierarchy.num_levels = argc - optind;
+    hierarchy.levels = calloc(hierarchy.num_levels, sizeof(struct hierarchy_level));
+    for (unsigned i = 0; i < hierarchy.num_levels; i++) {
+        // Every level gets its own seed, so that their RAND victims are
+        // independent.
+        if (hierarchy_level_init(&hierarchy.levels[i], argv[optind + i], seed + i) != 0) goto out;
+    }
+    if (hierarchy.inclusion == INCLUSION_EXCLUSIVE) {
+        for (unsigned i = 1; i < hierarchy.num_levels; i++) {
+            if (hierarchy.levels[i].cache_system->line_size !=
+                hierarchy.levels[0].cache_system->line_size) {
+                fprintf(stderr, "Every level of an exclusive hierarchy needs the same line "
+                                "size.\n");
+                goto out;
+            }
+        }
+    }
+
+    // A level hands down a full buffer as soon as it fills up, and the
+    // requests of an access at most once it is done.
+    hierarchy.flush_threshold =
+        hierarchy.inclusion == INCLUSION_NINE ? HIERARCHY_BATCH_SIZE : 1;
+
+    if (verbosity >= VERBOSITY_SUMMARY) {
+        static const char *inclusion_names[] = {"nine", "inclusive", "exclusive"};
+        printf("Hierarchy Info\n");
+        printf("==============\n");
+        printf("Inclusion: %s\n", inclusion_names[hierarchy.inclusion]);
+        for (unsigned i = 0; i < hierarchy.num_levels; i++) {
+            const struct hierarchy_level *level = &hierarchy.levels[i];
+            printf("L%u: %s, %zu bytes, %zu lines, %zu-way, %u cycles\n", i + 1, level->policy,
+                   level->cache_size, level->cache_lines, level->associativity,
+                   level->latency);
+        }
+        printf("Memory: %u cycles\n", hierarchy.memory_latency);
+    }
+
+    struct trace_reader *reader = trace_reader_open(trace_path);
+    if (reader == NULL) goto out;
+    const uint64_t *records;
+    ssize_t count;
+    while ((count = trace_reader_next_batch(reader, &records)) > 0) {
+        if (hierarchy.inclusion == INCLUSION_EXCLUSIVE) {
+            for (ssize_t r = 0; r < count; r++) {
+                if (exclusive_access(&hierarchy, trace_record_address(records[r]),
+                                     trace_record_rw(records[r])) != 0) {
+                    count = -1;
+                    break;
+                }
+            }
+            if (count < 0) break;
+        } else if (hierarchy_feed(&hierarchy, 0, records, count) != 0) {
+            count = -1;
+            break;
+        }
+    }
+    trace_reader_close(reader);
+    if (count < 0) goto out;
+
+    // Drain the buffered requests, from the top so that every level's
+    // requests reach the next one before it is drained.
+    for (unsigned i = 0; i < hierarchy.num_levels; i++) {
+        if (hierarchy_flush(&hierarchy, i) != 0) goto out;
+    }
+
+    if (verbosity >= VERBOSITY_SUMMARY) printf("\n");
+    hierarchy_print(&hierarchy);
+    ret = 0;
+
+out:
+    for (unsigned i = 0; i < hierarchy.num_levels; i++) {
+        struct hierarchy_level *level = &hierarchy.levels[i];
+        if (level->cache_system != NULL) {
+            cache_system_cleanup(level->cache_system);
+            free(level->cache_system);
+        }
+        free(level->requests);
+    }
+    free(hierarchy.levels);
+    return ret;
+}
@@ -0,0 +1,32 @@
+//
+// This file defines the multi-level cache hierarchy mode, which chains several
+// cache systems (L1, L2, ...) and reports the statistics of every level along
+// with the average memory access time (AMAT).
+//
+// Each level only sees the requests the level above sends it: the lines it
+// missed on (as reads) and the dirty lines it evicted (as writebacks). The
+// last level sends its requests to memory. How the contents of the levels
+// relate is chosen with the inclusion policy:
+//
+//  * nine (non-inclusive, non-exclusive): the levels are independent. Requests
+//    are buffered and handed down in batches, so a lower level is only
+//    visited once per batch of misses from the level above.
+//  * inclusive: a lower level holds every line of the levels above it. When it
+//    evicts a line, the line is invalidated in the levels above, and a dirty
+//    copy there is written back in its place.
+//  * exclusive: a line is held by at most one level. A miss takes the line out
+//    of the first lower level that holds it, and every line evicted from a
+//    level (clean or dirty) moves to the level below it.
+//
+// Inclusive and exclusive hierarchies feed back into the levels above, so
+// their requests are handed down one miss at a time; levels below are still
+// never visited on a hit.
+//
+
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+// The entrypoint of "cachesim hierarchy". argv[0] is "hierarchy".
+int hierarchy_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,119 @@
+//
+// This file contains the implementations for the functions defined in
+// instrumentation.h.
+//
+
+#include "instrumentation.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct instrumentation *instrumentation_new(uint32_t sets, uint32_t associativity)
+{
+    struct instrumentation *instrumentation = calloc(1, sizeof(struct instrumentation));
+    instrumentation->num_sets = sets;
+    instrumentation->associativity = associativity;
+    instrumentation->sets = calloc(sets, sizeof(struct instrumentation_set));
+    instrumentation->last_access = calloc((size_t)sets * associativity, sizeof(uint64_t));
+    instrumentation->filled = calloc((size_t)sets * associativity, sizeof(uint64_t));
+    return instrumentation;
+}
+
+void instrumentation_cleanup(struct instrumentation *instrumentation)
+{
+    if (!instrumentation->borrowed) {
+        free(instrumentation->sets);
+        free(instrumentation->last_access);
+        free(instrumentation->filled);
+    }
+    free(instrumentation);
+}
+
+struct instrumentation *instrumentation_fork(const struct instrumentation *instrumentation)
+{
+    struct instrumentation *fork = malloc(sizeof(struct instrumentation));
+    *fork = *instrumentation;
+    memset(fork->reuse_distance, 0, sizeof(fork->reuse_distance));
+    memset(fork->eviction_age, 0, sizeof(fork->eviction_age));
+    fork->borrowed = true;
+    return fork;
+}
+
+void instrumentation_join(struct instrumentation *instrumentation, struct instrumentation *fork)
+{
+    for (unsigned b = 0; b < INSTRUMENTATION_BUCKETS; b++) {
+        instrumentation->reuse_distance[b] += fork->reuse_distance[b];
+        instrumentation->eviction_age[b] += fork->eviction_age[b];
+    }
+    instrumentation_cleanup(fork);
+}
+
+// The number of buckets up to the last non-empty one.
+static unsigned histogram_length(const uint64_t *histogram)
+{
+    unsigned length = INSTRUMENTATION_BUCKETS;
+    while (length > 0 && histogram[length - 1] == 0) length--;
+    return length;
+}
+
+// The smallest distance counted by bucket b.
+static uint64_t bucket_min(unsigned b)
+{
+    return b == 0 ? 0 : UINT64_C(1) << (b - 1);
+}
+
+static void write_histogram_json(const char *name, const uint64_t *histogram, bool last,
+                                 FILE *out)
+{
+    fprintf(out, "  \"%s\": [", name);
+    unsigned length = histogram_length(histogram);
+    for (unsigned b = 0; b < length; b++) {
+        fprintf(out, "%s{\"min\": %" PRIu64 ", \"count\": %" PRIu64 "}", b ? ", " : "",
+                bucket_min(b), histogram[b]);
+    }
+    fprintf(out, "]%s\n", last ? "" : ",");
+}
+
+void instrumentation_write_json(const struct instrumentation *instrumentation, FILE *out)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"sets\": [\n");
+    for (uint32_t s = 0; s < instrumentation->num_sets; s++) {
+        const struct instrumentation_set *set = &instrumentation->sets[s];
+        fprintf(out,
+                "    {\"set\": %" PRIu32 ", \"hits\": %" PRIu64 ", \"misses\": %" PRIu64
+                ", \"evictions\": %" PRIu64 ", \"dirty_evictions\": %" PRIu64 "}%s\n",
+                s, set->hits, set->misses, set->evictions, set->dirty_evictions,
+                s + 1 < instrumentation->num_sets ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    write_histogram_json("reuse_distance", instrumentation->reuse_distance, false, out);
+    write_histogram_json("eviction_age", instrumentation->eviction_age, true, out);
+    fprintf(out, "}\n");
+}
+
+// The CSV has one row per value: the table, a row key (the set, or the
+// smallest distance of the bucket), the column, and the value.
+void instrumentation_write_csv(const struct instrumentation *instrumentation, FILE *out)
+{
+    fprintf(out, "table,key,column,value\n");
+    for (uint32_t s = 0; s < instrumentation->num_sets; s++) {
+        const struct instrumentation_set *set = &instrumentation->sets[s];
+        fprintf(out, "sets,%" PRIu32 ",hits,%" PRIu64 "\n", s, set->hits);
+        fprintf(out, "sets,%" PRIu32 ",misses,%" PRIu64 "\n", s, set->misses);
+        fprintf(out, "sets,%" PRIu32 ",evictions,%" PRIu64 "\n", s, set->evictions);
+        fprintf(out, "sets,%" PRIu32 ",dirty_evictions,%" PRIu64 "\n", s,
+                set->dirty_evictions);
+    }
+    unsigned length = histogram_length(instrumentation->reuse_distance);
+    for (unsigned b = 0; b < length; b++) {
+        fprintf(out, "reuse_distance,%" PRIu64 ",count,%" PRIu64 "\n", bucket_min(b),
+                instrumentation->reuse_distance[b]);
+    }
+    length = histogram_length(instrumentation->eviction_age);
+    for (unsigned b = 0; b < length; b++) {
+        fprintf(out, "eviction_age,%" PRIu64 ",count,%" PRIu64 "\n", bucket_min(b),
+                instrumentation->eviction_age[b]);
+    }
+}
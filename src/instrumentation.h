@@ -0,0 +1,103 @@
+//
+// This file defines the optional instrumentation of a cache system: per-set
+// counters and log2-bucketed histograms of reuse distances and eviction ages,
+// written out as JSON or CSV at the end of a run.
+//
+// A cache system without instrumentation (the default) only pays for one
+// pointer test per access.
+//
+// Distances and ages count demand accesses to the same set. The reuse distance
+// of a hit is the number of accesses to its set since the line was last
+// accessed, and the age of an evicted line the number since it was filled (so
+// a line hit right after its fill has a reuse distance of 0). Bucket 0 counts
+// a distance of 0, and bucket b (b >= 1) counts distances in [2^(b-1), 2^b).
+//
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define INSTRUMENTATION_BUCKETS 65
+
+struct instrumentation_set {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t dirty_evictions;
+};
+
+struct instrumentation {
+    uint32_t num_sets, associativity;
+
+    // Per set, and per line (indexed like cache_system->tags): the set time of
+    // the last access and of the fill.
+    struct instrumentation_set *sets;
+    uint64_t *last_access;
+    uint64_t *filled;
+
+    uint64_t reuse_distance[INSTRUMENTATION_BUCKETS];
+    uint64_t eviction_age[INSTRUMENTATION_BUCKETS];
+
+    // Whether the arrays above belong to another instrumentation (see
+    // instrumentation_fork).
+    bool borrowed;
+};
+
+struct instrumentation *instrumentation_new(uint32_t sets, uint32_t associativity);
+void instrumentation_cleanup(struct instrumentation *instrumentation);
+
+// For worker threads that each simulate a disjoint subset of the sets: a
+// copy that shares the per-set and per-line arrays but has its own
+// histograms. instrumentation_join adds the histograms back and frees the
+// copy.
+struct instrumentation *instrumentation_fork(const struct instrumentation *instrumentation);
+void instrumentation_join(struct instrumentation *instrumentation, struct instrumentation *fork);
+
+// Write the counters and histograms to out, as JSON or CSV.
+void instrumentation_write_json(const struct instrumentation *instrumentation, FILE *out);
+void instrumentation_write_csv(const struct instrumentation *instrumentation, FILE *out);
+
+static inline unsigned instrumentation_bucket(uint64_t distance)
+{
+    return distance == 0 ? 0 : 64 - __builtin_clzll(distance);
+}
+
+// Record one access to the line at way of set_idx. evicted tells whether the
+// access replaced a valid line, and dirty whether that line was MODIFIED.
+static inline void instrumentation_record(struct instrumentation *instrumentation,
+                                          uint32_t set_idx, uint32_t way, bool demand, bool hit,
+                                          bool evicted, bool dirty)
+{
+    struct instrumentation_set *set = &instrumentation->sets[set_idx];
+    size_t line = (size_t)set_idx * instrumentation->associativity + way;
+    uint64_t now = set->hits + set->misses;
+
+    if (hit) {
+        if (demand) {
+            instrumentation->reuse_distance[instrumentation_bucket(
+                now - instrumentation->last_access[line])]++;
+        }
+    } else {
+        if (evicted) {
+            set->evictions++;
+            set->dirty_evictions += dirty;
+            instrumentation->eviction_age[instrumentation_bucket(
+                now - instrumentation->filled[line])]++;
+        }
+    }
+    if (demand) {
+        if (hit) {
+            set->hits++;
+        } else {
+            set->misses++;
+        }
+        now++;
+    }
+    if (!hit) instrumentation->filled[line] = now;
+    instrumentation->last_access[line] = now;
+}
+
+#endif
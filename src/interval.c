@@ -0,0 +1,222 @@
+//
+// This file contains the implementations for the functions defined in
+// interval.h.
+//
+
+#include "interval.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The queue starts with room for this many intervals and doubles when full.
+#define INTERVAL_QUEUE_CAPACITY 256
+
+struct interval_writer {
+    FILE *out;
+    const char *path;
+    bool csv;
+    uint64_t length, warmup, num_lines;
+
+    // Simulating thread only: the end of the warm-up or of the current
+    // interval, and the counters at its start.
+    uint64_t due;
+    bool warm;
+    uint64_t start;
+    struct cache_system_stats last;
+
+    // Shared with the writer thread, under lock. The writer takes the whole
+    // queue at once, so the simulating thread only waits for the swap.
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    struct interval_record *queue;
+    size_t count, capacity;
+    bool closed;
+
+    pthread_t thread;
+    int status;
+};
+
+static void interval_write(struct interval_writer *writer, const struct interval_record *record)
+{
+    if (writer->csv) {
+        fprintf(writer->out,
+                "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%.8f,%" PRIu64 ",%.8f\n",
+                record->start, record->end, record->accesses, record->hits, record->misses,
+                record->dirty_evictions,
+                record->accesses > 0 ? (double)record->hits / record->accesses : 0.0,
+                record->valid_lines, (double)record->valid_lines / writer->num_lines);
+        return;
+    }
+    struct interval_record le = {
+        .start = htole64(record->start),
+        .end = htole64(record->end),
+        .accesses = htole64(record->accesses),
+        .hits = htole64(record->hits),
+        .misses = htole64(record->misses),
+        .dirty_evictions = htole64(record->dirty_evictions),
+        .valid_lines = htole64(record->valid_lines),
+    };
+    fwrite(&le, sizeof(le), 1, writer->out);
+}
+
+static void *interval_writer_main(void *arg)
+{
+    struct interval_writer *writer = arg;
+    struct interval_record *records = malloc(INTERVAL_QUEUE_CAPACITY * sizeof(*records));
+    size_t capacity = INTERVAL_QUEUE_CAPACITY;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->count == 0 && !writer->closed) {
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        }
+        if (writer->count == 0) break;
+
+        // Swap the queue with the (empty) local buffer and write it unlocked.
+        struct interval_record *taken = writer->queue;
+        size_t count = writer->count;
+        size_t taken_capacity = writer->capacity;
+        writer->queue = records;
+        writer->capacity = capacity;
+        writer->count = 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        for (size_t i = 0; i < count; i++) {
+            interval_write(writer, &taken[i]);
+        }
+        records = taken;
+        capacity = taken_capacity;
+
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    free(records);
+    if (fflush(writer->out) != 0 || ferror(writer->out)) {
+        fprintf(stderr, "%s: %s\n", writer->path, strerror(errno));
+        writer->status = 1;
+    }
+    return NULL;
+}
+
+struct interval_writer *interval_writer_new(const char *path, uint64_t length, uint64_t warmup,
+                                            const struct cache_system *cache_system,
+                                            uint64_t position)
+{
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct interval_writer *writer = calloc(1, sizeof(struct interval_writer));
+    writer->out = out;
+    writer->path = path;
+    size_t path_length = strlen(path);
+    writer->csv = path_length >= 4 && !strcmp(path + path_length - 4, ".csv");
+    writer->length = length;
+    writer->warmup = warmup;
+    writer->num_lines = (uint64_t)cache_system->num_sets * cache_system->associativity;
+
+    if (position < warmup) {
+        writer->due = warmup;
+    } else {
+        writer->warm = true;
+        writer->start = position;
+        writer->last = cache_system->stats;
+        writer->due = warmup + ((position - warmup) / length + 1) * length;
+    }
+
+    if (writer->csv) {
+        fprintf(out, "start,end,accesses,hits,misses,dirty_evictions,hit_ratio,valid_lines,"
+                     "occupancy\n");
+    } else {
+        struct interval_file_header header = {
+            .magic = INTERVAL_FILE_MAGIC,
+            .version = htole32(INTERVAL_FILE_VERSION),
+            .record_size = htole32(sizeof(struct interval_record)),
+            .length = htole64(length),
+            .warmup = htole64(warmup),
+            .num_lines = htole64(writer->num_lines),
+        };
+        fwrite(&header, sizeof(header), 1, out);
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    writer->capacity = INTERVAL_QUEUE_CAPACITY;
+    writer->queue = malloc(writer->capacity * sizeof(struct interval_record));
+    pthread_create(&writer->thread, NULL, interval_writer_main, writer);
+    return writer;
+}
+
+uint64_t interval_writer_due(const struct interval_writer *writer)
+{
+    return writer->due;
+}
+
+// Queue the interval that ends at position.
+static void interval_writer_queue(struct interval_writer *writer,
+                                  const struct cache_system *cache_system, uint64_t position)
+{
+    const struct cache_system_stats *stats = &cache_system->stats;
+    struct interval_record record = {
+        .start = writer->start,
+        .end = position,
+        .accesses = stats->accesses - writer->last.accesses,
+        .hits = stats->hits - writer->last.hits,
+        .misses = stats->misses - writer->last.misses,
+        .dirty_evictions = stats->dirty_evictions - writer->last.dirty_evictions,
+        .valid_lines = cache_system->valid_lines,
+    };
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->count == writer->capacity) {
+        writer->capacity *= 2;
+        writer->queue = realloc(writer->queue, writer->capacity * sizeof(struct interval_record));
+    }
+    writer->queue[writer->count++] = record;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+void interval_writer_end(struct interval_writer *writer, const struct cache_system *cache_system)
+{
+    if (writer->warm) {
+        interval_writer_queue(writer, cache_system, writer->due);
+    }
+    writer->warm = true;
+    writer->start = writer->due;
+    writer->last = cache_system->stats;
+    writer->due += writer->length;
+}
+
+int interval_writer_close(struct interval_writer *writer, const struct cache_system *cache_system,
+                          uint64_t position)
+{
+    if (writer->warm && position > writer->start) {
+        interval_writer_queue(writer, cache_system, position);
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->closed = true;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int status = writer->status;
+    if (fclose(writer->out) != 0 && status == 0) {
+        fprintf(stderr, "%s: %s\n", writer->path, strerror(errno));
+        status = 1;
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued);
+    free(writer->queue);
+    free(writer);
+    return status;
+}
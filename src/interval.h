@@ -0,0 +1,64 @@
+//
+// This file defines interval statistics: the hits, misses, dirty evictions
+// and occupancy of a cache system over every window of a fixed number of
+// trace records, streamed to a file while the simulation runs.
+//
+// The first warmup records are not reported; after them, an interval ends
+// every length records (at absolute trace positions, so a run restored from
+// a checkpoint keeps the same windows), and a shorter last interval covers
+// whatever is left at the end of the trace.
+//
+// The simulating thread only snapshots its counters into a queue. A
+// background thread formats and writes the queued intervals, so the
+// simulation never waits for the file.
+//
+
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory_system.h"
+
+// The header at the start of a binary interval file. It is followed by one
+// struct interval_record per interval. Every field is little-endian.
+#define INTERVAL_FILE_MAGIC "CSIMIVL"
+#define INTERVAL_FILE_VERSION 1
+struct interval_file_header {
+    char magic[8];        // INTERVAL_FILE_MAGIC, NUL-padded
+    uint32_t version;     // INTERVAL_FILE_VERSION
+    uint32_t record_size; // sizeof(struct interval_record)
+    uint64_t length, warmup;
+    uint64_t num_lines; // The capacity of the cache, for the occupancy.
+};
+
+struct interval_record {
+    uint64_t start, end; // Trace positions: records [start, end).
+    uint64_t accesses, hits, misses, dirty_evictions;
+    uint64_t valid_lines; // At the end of the interval.
+};
+
+struct interval_writer;
+
+// Stream the intervals of cache_system, which has simulated the first
+// position records of its trace, to path: as CSV if path ends in ".csv",
+// otherwise in the binary format above. Returns NULL (after printing an
+// error) if the file cannot be created.
+struct interval_writer *interval_writer_new(const char *path, uint64_t length, uint64_t warmup,
+                                            const struct cache_system *cache_system,
+                                            uint64_t position);
+
+// The trace position at which interval_writer_end must be called next.
+uint64_t interval_writer_due(const struct interval_writer *writer);
+
+// End the warm-up or the current interval. Must be called exactly when
+// cache_system has simulated interval_writer_due records.
+void interval_writer_end(struct interval_writer *writer, const struct cache_system *cache_system);
+
+// Queue the last (partial) interval, wait for every interval to be written
+// and free the writer. Returns 0 if everything was written.
+int interval_writer_close(struct interval_writer *writer, const struct cache_system *cache_system,
+                          uint64_t position);
+
+#endif
@@ -0,0 +1,116 @@
+//
+// This file contains the implementations for the functions defined in
+// libcachesim.h, on top of the cache system.
+//
+
+#include "libcachesim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory_system.h"
+#include "replacement_policies.h"
+
+struct cachesim {
+    struct cache_system *cache_system;
+};
+
+static void cachesim_error(cachesim_diagnostic_fn diagnostic, void *data, const char *format, ...)
+{
+    if (diagnostic == NULL) return;
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    diagnostic(data, message);
+}
+
+static int is_power_of_two(uint64_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+struct cachesim *cachesim_new(const char *policy, uint64_t cache_size, uint64_t cache_lines,
+                              uint32_t associativity, uint64_t seed,
+                              cachesim_diagnostic_fn diagnostic, void *data)
+{
+    // Check everything that cache_system_new would otherwise print about.
+    if (cache_lines == 0 || associativity == 0 || cache_lines % associativity != 0 ||
+        cache_size % cache_lines != 0) {
+        cachesim_error(diagnostic, data,
+                       "%" PRIu64 " lines do not divide into a %" PRIu64
+                       "-byte cache with associativity %u",
+                       cache_lines, cache_size, associativity);
+        return NULL;
+    }
+    uint64_t line_size = cache_size / cache_lines;
+    uint64_t sets = cache_lines / associativity;
+    if (!is_power_of_two(line_size) || !is_power_of_two(sets) || line_size > UINT32_MAX ||
+        sets > UINT32_MAX || (line_size == 1 && sets == 1)) {
+        cachesim_error(diagnostic, data,
+                       "a line size of %" PRIu64 " and %" PRIu64
+                       " sets are not valid; both must be powers of two, and not both 1",
+                       line_size, sets);
+        return NULL;
+    }
+
+    struct cache_system *cache_system = cache_system_new(line_size, sets, associativity);
+    if (cache_system == NULL) {
+        cachesim_error(diagnostic, data, "out of memory");
+        return NULL;
+    }
+    cache_system->diagnostic = diagnostic;
+    cache_system->diagnostic_data = data;
+    cache_system->replacement_policy = replacement_policy_new(policy, sets, associativity, seed);
+    if (cache_system->replacement_policy == NULL) {
+        cachesim_error(diagnostic, data, "unknown replacement policy %s", policy);
+        cache_system_cleanup(cache_system);
+        free(cache_system);
+        return NULL;
+    }
+
+    struct cachesim *sim = malloc(sizeof(struct cachesim));
+    if (sim == NULL) {
+        cachesim_error(diagnostic, data, "out of memory");
+        cache_system_cleanup(cache_system);
+        free(cache_system);
+        return NULL;
+    }
+    sim->cache_system = cache_system;
+    return sim;
+}
+
+void cachesim_free(struct cachesim *sim)
+{
+    if (sim == NULL) return;
+    cache_system_cleanup(sim->cache_system);
+    free(sim->cache_system);
+    free(sim);
+}
+
+int cachesim_access_batch(struct cachesim *sim, const uint64_t *addresses, const uint8_t *writes,
+                          size_t count, struct cachesim_stats *stats, uint64_t *hits,
+                          uint64_t *dirty_evictions)
+{
+    struct cache_system *cache_system = sim->cache_system;
+    struct cache_system_stats before = cache_system->stats;
+    int status = cache_system_mem_access_arrays(cache_system, addresses, writes, count, hits,
+                                                dirty_evictions);
+    if (stats != NULL) {
+        stats->accesses = cache_system->stats.accesses - before.accesses;
+        stats->hits = cache_system->stats.hits - before.hits;
+        stats->misses = cache_system->stats.misses - before.misses;
+        stats->dirty_evictions = cache_system->stats.dirty_evictions - before.dirty_evictions;
+    }
+    return status;
+}
+
+void cachesim_get_stats(const struct cachesim *sim, struct cachesim_stats *stats)
+{
+    stats->accesses = sim->cache_system->stats.accesses;
+    stats->hits = sim->cache_system->stats.hits;
+    stats->misses = sim->cache_system->stats.misses;
+    stats->dirty_evictions = sim->cache_system->stats.dirty_evictions;
+}
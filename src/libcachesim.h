@@ -0,0 +1,67 @@
+//
+// This file is the public interface of libcachesim, the simulator as a
+// library for embedding in other programs (build it with "make lib").
+//
+// A simulator is an opaque handle for one cache. Accesses are passed in
+// batches of plain arrays, so a trace generator can drive the cache without
+// going through a trace file, and the library never prints: errors are
+// passed to an optional diagnostic callback instead. Separate handles can be
+// used from separate threads; a single handle must not be used concurrently.
+//
+
+#ifndef LIBCACHESIM_H
+#define LIBCACHESIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHESIM_API __attribute__((visibility("default")))
+
+struct cachesim;
+
+struct cachesim_stats {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t dirty_evictions;
+};
+
+// Receives a message describing an error, with the data pointer given to
+// cachesim_new.
+typedef void (*cachesim_diagnostic_fn)(void *data, const char *message);
+
+// Create a simulator for a cache of cache_size bytes in cache_lines lines,
+// with the given associativity and replacement policy ("LRU", "RAND",
+// "LRU_PREFER_CLEAN", "PLRU", "SRRIP" or "BRRIP"). The line size and the
+// number of sets must be powers of two. RAND draws the same victims for the
+// same seed. diagnostic may be NULL. Returns NULL (after reporting the error
+// to diagnostic) if the cache is not valid.
+CACHESIM_API struct cachesim *cachesim_new(const char *policy, uint64_t cache_size,
+                                           uint64_t cache_lines, uint32_t associativity,
+                                           uint64_t seed, cachesim_diagnostic_fn diagnostic,
+                                           void *data);
+CACHESIM_API void cachesim_free(struct cachesim *sim);
+
+// Simulate count accesses: access i is of addresses[i], and is a write if
+// writes is not NULL and writes[i] is not 0. If stats is not NULL, it
+// receives the statistics of this batch alone. If hits or dirty_evictions is
+// not NULL, it must have room for (count + 63) / 64 words, and bit i % 64 of
+// word i / 64 is set when access i hit or evicted a dirty line. Returns 0 on
+// success.
+CACHESIM_API int cachesim_access_batch(struct cachesim *sim, const uint64_t *addresses,
+                                       const uint8_t *writes, size_t count,
+                                       struct cachesim_stats *stats, uint64_t *hits,
+                                       uint64_t *dirty_evictions);
+
+// The statistics of every access since the simulator was created.
+CACHESIM_API void cachesim_get_stats(const struct cachesim *sim, struct cachesim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+//
+// This file contains the implementations for the functions defined in
+// line_map.h.
+//
+
+#include "line_map.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline size_t line_map_hash(const struct line_map *map, uint64_t key)
+{
+    return (key * UINT64_C(0x9e3779b97f4a7c15)) >> 17 & (map->capacity - 1);
+}
+
+static void line_map_alloc(struct line_map *map, size_t capacity)
+{
+    map->capacity = capacity;
+    map->count = 0;
+    map->entries = malloc(capacity * sizeof(struct line_map_entry));
+    memset(map->entries, 0xff, capacity * sizeof(struct line_map_entry));
+}
+
+void line_map_init(struct line_map *map, size_t expected_count)
+{
+    // Keep the load factor at or below one half.
+    size_t capacity = 16;
+    while (capacity < 2 * expected_count) capacity *= 2;
+    line_map_alloc(map, capacity);
+}
+
+void line_map_cleanup(struct line_map *map)
+{
+    free(map->entries);
+}
+
+void line_map_clear(struct line_map *map)
+{
+    memset(map->entries, 0xff, map->capacity * sizeof(struct line_map_entry));
+    map->count = 0;
+}
+
+uint64_t *line_map_find(struct line_map *map, uint64_t key)
+{
+    for (size_t i = line_map_hash(map, key);; i = (i + 1) & (map->capacity - 1)) {
+        struct line_map_entry *e = &map->entries[i];
+        if (e->key == key) return &e->value;
+        if (e->key == LINE_MAP_EMPTY) return NULL;
+    }
+}
+
+static void line_map_grow(struct line_map *map)
+{
+    struct line_map_entry *old = map->entries;
+    size_t old_capacity = map->capacity;
+    line_map_alloc(map, old_capacity * 2);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key == LINE_MAP_EMPTY) continue;
+        bool inserted;
+        *line_map_insert(map, old[i].key, &inserted) = old[i].value;
+    }
+    free(old);
+}
+
+uint64_t *line_map_insert(struct line_map *map, uint64_t key, bool *inserted)
+{
+    if (2 * (map->count + 1) > map->capacity) {
+        line_map_grow(map);
+    }
+    for (size_t i = line_map_hash(map, key);; i = (i + 1) & (map->capacity - 1)) {
+        struct line_map_entry *e = &map->entries[i];
+        if (e->key == key) {
+            *inserted = false;
+            return &e->value;
+        }
+        if (e->key == LINE_MAP_EMPTY) {
+            e->key = key;
+            e->value = 0;
+            map->count++;
+            *inserted = true;
+            return &e->value;
+        }
+    }
+}
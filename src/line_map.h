@@ -0,0 +1,45 @@
+//
+// This file defines a hash map from cache line addresses to 64-bit values.
+//
+// It is an open-addressing table with linear probing, used by the analyses
+// that need to remember something about every distinct line in a trace (for
+// example, when the line was last used).
+//
+
+#ifndef LINE_MAP_H
+#define LINE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Line addresses are at most 63 bits wide, so this key is never used.
+#define LINE_MAP_EMPTY UINT64_MAX
+
+struct line_map_entry {
+    uint64_t key;
+    uint64_t value;
+};
+
+struct line_map {
+    struct line_map_entry *entries;
+    size_t capacity; // Always a power of two.
+    size_t count;
+};
+
+void line_map_init(struct line_map *map, size_t expected_count);
+void line_map_cleanup(struct line_map *map);
+
+// Remove every entry without releasing the table.
+void line_map_clear(struct line_map *map);
+
+// Return a pointer to the value for key, or NULL if key is not in the map.
+// The pointer is valid until the next insertion.
+uint64_t *line_map_find(struct line_map *map, uint64_t key);
+
+// Return a pointer to the value for key, inserting key with a value of 0 if
+// it is not in the map yet. *inserted is set to whether key was inserted. The
+// pointer is valid until the next insertion.
+uint64_t *line_map_insert(struct line_map *map, uint64_t key, bool *inserted);
+
+#endif
@@ -3,29 +3,260 @@
 //
 // This file handles all of the argument and input parsing as well as the
 // output printing. It calls the active cache system for each of the memory
-// accesses received via stdin.
+// accesses received via stdin (or the trace file given with -t).
 //
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "checkpoint.h"
+#include "hierarchy.h"
+#include "instrumentation.h"
+#include "interval.h"
 #include "memory_system.h"
+#include "multicore.h"
+#include "next_use.h"
+#include "parallel.h"
 #include "replacement_policies.h"
+#include "sampling.h"
+#include "stack_distance.h"
+#include "sweep.h"
+#include "trace.h"
+
+// Size of the stdout buffer used when every access is traced. Per-access
+// output is written through this buffer instead of line-at-a-time stdio.
+#define TRACE_OUTPUT_BUFFER_SIZE (1 << 20)
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-v quiet|summary|full] [-t trace_file] [-j threads] [-s stats_file] "
+            "[-f sample_fraction] [-m]\n"
+            "          [-c checkpoint_file [-C interval]] [-r checkpoint_file]\n"
+            "          [-i interval -o interval_file [-w warmup]] [-S seed]\n"
+            "          <policy> <cache_size> <cache_lines> <associativity> [< <trace_file>]\n"
+            "       %s [-t trace_file] LRU_STACK <max_cache_size> <line_size> [< <trace_file>]\n"
+            "       %s convert <text_trace> <binary_trace>\n"
+            "       %s sweep [options]  (see '%s sweep -h')\n"
+            "       %s hierarchy [options] <level> ...  (see '%s hierarchy -h')\n"
+            "       %s multicore [options] <policy> <cache_size> <cache_lines> <associativity> "
+            "<trace_file> ...\n",
+            prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+// Take the next batch of records from the reader or, if there is none, from
+// the loaded trace, of which the first *consumed records were taken already.
+static ssize_t next_batch(struct trace_reader *reader, const struct trace *trace,
+                          size_t *consumed, const uint64_t **records)
+{
+    if (reader != NULL) {
+        return trace_reader_next_batch(reader, records);
+    }
+    size_t count = trace->count - *consumed;
+    if (count > TRACE_BATCH_SIZE) count = TRACE_BATCH_SIZE;
+    *records = trace->records + *consumed;
+    *consumed += count;
+    return count;
+}
 
 int main(int argc, char **argv)
 {
+    // Subcommands.
+    if (argc > 1 && !strcmp("convert", argv[1])) {
+        if (argc != 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return trace_convert(argv[2], argv[3]);
+    }
+    if (argc > 1 && !strcmp("sweep", argv[1])) {
+        return sweep_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && !strcmp("hierarchy", argv[1])) {
+        return hierarchy_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && !strcmp("multicore", argv[1])) {
+        return multicore_main(argc - 1, argv + 1);
+    }
+
+    // Parse the options.
+    enum cache_system_verbosity verbosity = VERBOSITY_FULL;
+    const char *trace_path = NULL;
+    unsigned num_threads = 1;
+    const char *stats_path = NULL;
+    double sample_fraction = 1;
+    const char *checkpoint_path = NULL;
+    uint64_t checkpoint_interval = 0;
+    const char *restore_path = NULL;
+    uint64_t interval_length = 0;
+    uint64_t interval_warmup = 0;
+    const char *interval_path = NULL;
+    uint64_t seed = REPLACEMENT_POLICY_DEFAULT_SEED;
+    bool coalesce = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "v:t:j:s:f:c:C:r:i:w:o:S:m")) != -1) {
+        switch (opt) {
+        case 'm':
+            coalesce = true;
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval_length = strtoull(optarg, NULL, 10);
+            if (interval_length < 1) {
+                fprintf(stderr, "The interval length must be positive.\n");
+                return 1;
+            }
+            break;
+        case 'w':
+            interval_warmup = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            interval_path = optarg;
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
+        case 'C':
+            checkpoint_interval = strtoull(optarg, NULL, 10);
+            if (checkpoint_interval < 1) {
+                fprintf(stderr, "The checkpoint interval must be positive.\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            restore_path = optarg;
+            break;
+        case 'j':
+            num_threads = strtoul(optarg, NULL, 10);
+            if (num_threads < 1) {
+                fprintf(stderr, "The number of threads must be positive.\n");
+                return 1;
+            }
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 's':
+            stats_path = optarg;
+            break;
+        case 'f':
+            sample_fraction = strtod(optarg, NULL);
+            if (!(sample_fraction > 0 && sample_fraction <= 1)) {
+                fprintf(stderr, "The sample fraction must be in (0, 1].\n");
+                return 1;
+            }
+            break;
+        case 'v':
+            if (!strcmp("quiet", optarg)) {
+                verbosity = VERBOSITY_QUIET;
+            } else if (!strcmp("summary", optarg)) {
+                verbosity = VERBOSITY_SUMMARY;
+            } else if (!strcmp("full", optarg)) {
+                verbosity = VERBOSITY_FULL;
+            } else {
+                fprintf(stderr, "Unknown verbosity %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The LRU_STACK analysis covers every geometry at once, so it only takes
+    // the largest cache size and the line size.
+    if (argc - optind == 3 && !strcmp("LRU_STACK", argv[optind])) {
+        size_t max_cache_size = strtoul(argv[optind + 1], NULL, 10);
+        uint32_t line_size = strtoul(argv[optind + 2], NULL, 10);
+        struct trace trace;
+        if (trace_load(trace_path, &trace) != 0) {
+            return 1;
+        }
+        int ret = lru_stack_analyze(&trace, line_size, max_cache_size, stdout);
+        trace_cleanup(&trace);
+        return ret;
+    }
+
     // Parse the arguments.
-    if (argc != 5) {
+    if (argc - optind != 4) {
         fprintf(stderr, "Incorrect number of arguments.\n");
+        usage(argv[0]);
         return 1;
     }
-    char *replacement_policy_str = argv[1];
+    char *replacement_policy_str = argv[optind];
     char *endptr;
-    size_t cache_size = strtol(argv[2], &endptr, 10);
-    size_t cache_lines = strtol(argv[3], &endptr, 10);
-    size_t associativity = strtol(argv[4], &endptr, 10);
+    size_t cache_size = strtol(argv[optind + 1], &endptr, 10);
+    size_t cache_lines = strtol(argv[optind + 2], &endptr, 10);
+    size_t associativity = strtol(argv[optind + 3], &endptr, 10);
+
+    if (num_threads > 1 && verbosity == VERBOSITY_FULL) {
+        fprintf(stderr, "-j needs -v quiet or -v summary, since per-access output would be "
+                        "interleaved.\n");
+        return 1;
+    }
+    if (checkpoint_interval > 0 && checkpoint_path == NULL) {
+        fprintf(stderr, "-C needs -c.\n");
+        return 1;
+    }
+    if (num_threads > 1 && (checkpoint_interval > 0 || restore_path != NULL)) {
+        fprintf(stderr, "-C and -r need a single thread.\n");
+        return 1;
+    }
+    // Only the cache system itself is checkpointed, so the state of sampling
+    // and of the detailed statistics would be lost.
+    if ((checkpoint_path != NULL || restore_path != NULL) && sample_fraction < 1) {
+        fprintf(stderr, "-f cannot be combined with -c or -r.\n");
+        return 1;
+    }
+    if (restore_path != NULL && stats_path != NULL) {
+        fprintf(stderr, "-s cannot be combined with -r.\n");
+        return 1;
+    }
+    // OPT follows the trace by counting the accesses, so it needs every one
+    // of them, in order.
+    bool opt_policy = !strcmp(replacement_policy_str, REPLACEMENT_POLICY_OPT);
+    if (opt_policy && (num_threads > 1 || sample_fraction < 1)) {
+        fprintf(stderr, "OPT cannot be combined with -j or -f.\n");
+        return 1;
+    }
+    // Coalesced runs are performed as a whole, so there is no per-access
+    // output or instrumentation for the accesses that were merged away.
+    if (coalesce && (verbosity == VERBOSITY_FULL || num_threads > 1 || stats_path != NULL ||
+                     sample_fraction < 1)) {
+        fprintf(stderr, "-m needs -v quiet or -v summary, and cannot be combined with -j, -s "
+                        "or -f.\n");
+        return 1;
+    }
+    if ((interval_length > 0) != (interval_path != NULL)) {
+        fprintf(stderr, "-i and -o must be given together.\n");
+        return 1;
+    }
+    if (interval_length > 0 && (num_threads > 1 || sample_fraction < 1)) {
+        fprintf(stderr, "-i cannot be combined with -j or -f.\n");
+        return 1;
+    }
+
+    // Open the statistics file before simulating, so that a bad path fails
+    // early.
+    FILE *stats_file = NULL;
+    if (stats_path != NULL) {
+        stats_file = fopen(stats_path, "w");
+        if (stats_file == NULL) {
+            perror(stats_path);
+            return 1;
+        }
+    }
+
+    static char trace_output_buffer[TRACE_OUTPUT_BUFFER_SIZE];
+    if (verbosity == VERBOSITY_FULL) {
+        setvbuf(stdout, trace_output_buffer, _IOFBF, sizeof(trace_output_buffer));
+    }
 
     // NOTE: calculate the line size and number of sets.
     // check the values like if they are powers of 2.
@@ -33,59 +264,229 @@ int main(int argc, char **argv)
     int sets = cache_lines / associativity;
 
     // Print out some parameter info
-    printf("Parameter Info\n");
-    printf("==============\n");
-    printf("Replacement Policy: %s\n", replacement_policy_str);
-    printf("Cache Size: %ld\n", cache_size);
-    printf("Cache Lines: %ld\n", cache_lines);
-    printf("Associativity: %ld\n", associativity);
-    printf("Line Size: %dB\n", line_size);
-    printf("Number of Sets: %d\n", sets);
+    if (verbosity >= VERBOSITY_SUMMARY) {
+        printf("Parameter Info\n");
+        printf("==============\n");
+        printf("Replacement Policy: %s\n", replacement_policy_str);
+        printf("Cache Size: %ld\n", cache_size);
+        printf("Cache Lines: %ld\n", cache_lines);
+        printf("Associativity: %ld\n", associativity);
+        printf("Line Size: %dB\n", line_size);
+        printf("Number of Sets: %d\n", sets);
+    }
 
     // Instantiate the cache system.
     struct cache_system *cache_system = cache_system_new(line_size, sets, associativity);
+    if (cache_system == NULL) {
+        return 1;
+    }
+    cache_system->verbosity = verbosity;
+    cache_system->coalesce = coalesce;
+    if (stats_file != NULL) {
+        cache_system->instrumentation = instrumentation_new(sets, associativity);
+    }
+    if (sample_fraction < 1) {
+        cache_system->sampling = set_sampling_new(sets, sample_fraction);
+        if (cache_system->sampling == NULL) {
+            return 1;
+        }
+    }
+    if (verbosity >= VERBOSITY_SUMMARY) {
+        cache_system_print_geometry(cache_system);
+    }
 
-    // Instantiate the replacement policy
+    // Instantiate the replacement policy. OPT first reads the whole trace to
+    // find the next use of every access, and the simulation then replays the
+    // loaded trace. The backward scan needs the trace in memory: a binary
+    // trace is mapped in place, any other one is decoded into 8 bytes per
+    // access.
+    struct trace opt_trace;
+    struct next_use *next_use = NULL;
     struct replacement_policy *replacement_policy;
-    if (!strcmp("LRU", replacement_policy_str)) {
-        replacement_policy =
-            lru_replacement_policy_new(cache_system->num_sets, cache_system->associativity);
-    } else if (!strcmp("RAND", replacement_policy_str)) {
-        replacement_policy =
-            rand_replacement_policy_new(cache_system->num_sets, cache_system->associativity);
-    } else if (!strcmp("LRU_PREFER_CLEAN", replacement_policy_str)) {
-        replacement_policy = lru_prefer_clean_replacement_policy_new(cache_system->num_sets,
-                                                                     cache_system->associativity);
+    if (opt_policy) {
+        if (trace_load(trace_path, &opt_trace) != 0) {
+            return 1;
+        }
+        next_use = next_use_build(&opt_trace, line_size);
+        if (next_use == NULL) {
+            return 1;
+        }
+        replacement_policy = opt_replacement_policy_new(cache_system->num_sets,
+                                                        cache_system->associativity, next_use);
     } else {
+        replacement_policy = replacement_policy_new(
+            replacement_policy_str, cache_system->num_sets, cache_system->associativity, seed);
+    }
+    if (replacement_policy == NULL) {
         fprintf(stderr, "Unknown replacement policy %s", replacement_policy_str);
         return 1;
     }
 
     cache_system->replacement_policy = replacement_policy;
 
+    // Continue from a checkpoint: the records it has already simulated are
+    // skipped below, by seeking in a binary trace and by parsing and dropping
+    // them in any other one.
+    uint64_t position = 0;
+    if (restore_path != NULL &&
+        checkpoint_restore(cache_system, replacement_policy_str, restore_path, &position) != 0) {
+        return 1;
+    }
+
     // Read the input and call the cache system mem_access function.
-    char rw = 0;
-    uint32_t address = 0;
-    while (scanf("%c %x\n", &rw, &address) >= 0) {
-        printf("%s at 0x%x\n", (rw == 'R' ? "read" : "write"), address);
-        if (cache_system_mem_access(cache_system, address, rw) != 0) {
+    struct trace_reader *trace_reader = NULL;
+    if (!opt_policy) {
+        trace_reader = trace_reader_open(trace_path);
+        if (trace_reader == NULL) {
+            return 1;
+        }
+    }
+    struct interval_writer *intervals = NULL;
+    if (interval_path != NULL) {
+        intervals = interval_writer_new(interval_path, interval_length, interval_warmup,
+                                        cache_system, position);
+        if (intervals == NULL) {
             return 1;
         }
     }
+    if (num_threads > 1) {
+        // Partition the sets between worker threads.
+        int status = parallel_mem_access(cache_system, trace_reader, num_threads);
+        trace_reader_close(trace_reader);
+        if (status != 0) {
+            return 1;
+        }
+    } else {
+        const uint64_t *records;
+        ssize_t count;
+        uint64_t skip = position;
+        size_t consumed = 0;
+        if (trace_reader != NULL) {
+            skip -= trace_reader_skip(trace_reader, skip);
+        } else {
+            consumed = skip < opt_trace.count ? skip : opt_trace.count;
+            skip -= consumed;
+        }
+        while ((count = next_batch(trace_reader, &opt_trace, &consumed, &records)) > 0) {
+            if (skip >= (uint64_t)count) {
+                skip -= count;
+                continue;
+            }
+            records += skip;
+            count -= skip;
+            skip = 0;
+
+            // Split the batch where an interval ends or a periodic checkpoint
+            // is due.
+            while (count > 0) {
+                ssize_t n = count;
+                if (checkpoint_interval > 0) {
+                    uint64_t due = checkpoint_interval - position % checkpoint_interval;
+                    if (due < (uint64_t)n) n = due;
+                }
+                if (intervals != NULL && interval_writer_due(intervals) - position < (uint64_t)n) {
+                    n = interval_writer_due(intervals) - position;
+                }
+                if (cache_system_mem_access_batch(cache_system, records, n) != 0) {
+                    return 1;
+                }
+                records += n;
+                count -= n;
+                position += n;
+                if (intervals != NULL && position == interval_writer_due(intervals)) {
+                    interval_writer_end(intervals, cache_system);
+                }
+                if (checkpoint_interval > 0 && position % checkpoint_interval == 0 &&
+                    checkpoint_save(cache_system, replacement_policy_str, position,
+                                    checkpoint_path) != 0) {
+                    return 1;
+                }
+            }
+        }
+        if (trace_reader != NULL) {
+            trace_reader_close(trace_reader);
+        }
+        if (count < 0) {
+            return 1;
+        }
+        if (skip > 0) {
+            fprintf(stderr, "The trace is shorter than the %" PRIu64 " records of %s.\n",
+                    position, restore_path);
+            return 1;
+        }
+    }
+    if (intervals != NULL && interval_writer_close(intervals, cache_system, position) != 0) {
+        return 1;
+    }
+
+    // Save the final state. After a parallel simulation the position is the
+    // number of accesses, since every record is one access.
+    if (checkpoint_path != NULL) {
+        if (num_threads > 1) position = cache_system->stats.accesses;
+        if (checkpoint_save(cache_system, replacement_policy_str, position, checkpoint_path) !=
+            0) {
+            return 1;
+        }
+    }
+
+    // With sampling, the statistics of the whole cache are estimated.
+    struct set_sampling_result estimates;
+    if (cache_system->sampling != NULL) {
+        set_sampling_estimate(cache_system->sampling, &estimates);
+        cache_system->stats.accesses = cache_system->sampling->accesses;
+        cache_system->stats.hits = llround(estimates.hits.value);
+        cache_system->stats.misses = cache_system->stats.accesses - cache_system->stats.hits;
+        cache_system->stats.dirty_evictions = llround(estimates.dirty_evictions.value);
+    }
 
     // Print the statistics
-    printf("\n\nStatistics\n");
-    printf("==========\n");
-    printf("OUTPUT ACCESSES %d\n", cache_system->stats.accesses);
-    printf("OUTPUT HITS %d\n", cache_system->stats.hits);
-    printf("OUTPUT MISSES %d\n", cache_system->stats.misses);
-    printf("OUTPUT DIRTY EVICTIONS %d\n", cache_system->stats.dirty_evictions);
+    if (verbosity >= VERBOSITY_SUMMARY) {
+        printf("\n\nStatistics\n");
+        printf("==========\n");
+    }
+    printf("OUTPUT ACCESSES %" PRIu64 "\n", cache_system->stats.accesses);
+    printf("OUTPUT HITS %" PRIu64 "\n", cache_system->stats.hits);
+    printf("OUTPUT MISSES %" PRIu64 "\n", cache_system->stats.misses);
+    printf("OUTPUT DIRTY EVICTIONS %" PRIu64 "\n", cache_system->stats.dirty_evictions);
     printf("OUTPUT HIT RATIO %.8f\n",
            (double)cache_system->stats.hits / cache_system->stats.accesses);
+    if (coalesce) {
+        printf("OUTPUT COALESCED RUNS %" PRIu64 " OF %" PRIu64 "\n", cache_system->coalesced_runs,
+               cache_system->coalesced_records);
+        printf("OUTPUT COALESCING RATIO %.4f\n",
+               cache_system->coalesced_runs > 0 ? (double)cache_system->coalesced_records /
+                                                      cache_system->coalesced_runs
+                                                : 1.0);
+    }
+    if (cache_system->sampling != NULL) {
+        printf("OUTPUT SAMPLED SETS %u OF %u\n", cache_system->sampling->num_sampled_sets,
+               cache_system->num_sets);
+        printf("OUTPUT HITS 95%% CI %.0f %.0f\n", estimates.hits.low, estimates.hits.high);
+        printf("OUTPUT MISSES 95%% CI %.0f %.0f\n", estimates.misses.low, estimates.misses.high);
+        printf("OUTPUT DIRTY EVICTIONS 95%% CI %.0f %.0f\n", estimates.dirty_evictions.low,
+               estimates.dirty_evictions.high);
+        printf("OUTPUT HIT RATIO 95%% CI %.8f %.8f\n", estimates.hit_ratio.low,
+               estimates.hit_ratio.high);
+    }
+
+    // Write the per-set counters and histograms.
+    if (stats_file != NULL) {
+        size_t length = strlen(stats_path);
+        if (length >= 4 && !strcmp(stats_path + length - 4, ".csv")) {
+            instrumentation_write_csv(cache_system->instrumentation, stats_file);
+        } else {
+            instrumentation_write_json(cache_system->instrumentation, stats_file);
+        }
+        fclose(stats_file);
+    }
 
     // Clean everything up.
     cache_system_cleanup(cache_system);
     free(cache_system);
+    if (opt_policy) {
+        next_use_cleanup(next_use);
+        trace_cleanup(&opt_trace);
+    }
 
     return 0;
 }
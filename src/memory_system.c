@@ -5,9 +5,19 @@
 
 #include "memory_system.h"
 
+#include <stdarg.h>
+#include <string.h>
+
+#include "access_kernel.h"
+#include "instrumentation.h"
+#include "sampling.h"
+#include "tag_lookup.h"
+#include "trace.h"
+
 struct cache_system *cache_system_new(uint32_t line_size, uint32_t sets, uint32_t associativity)
 {
     struct cache_system *cs = malloc(sizeof(struct cache_system));
+    if (cs == NULL) return NULL;
     cs->line_size = line_size;
     cs->num_sets = sets;
     cs->associativity = associativity;
@@ -17,61 +27,154 @@ struct cache_system *cache_system_new(uint32_t line_size, uint32_t sets, uint32_
     // NOTE: calculate the index bits, offset bits and tag bits.
     cs->index_bits = log2(sets);
     cs->offset_bits = log2(line_size);
-    cs->tag_bits = 32 - cs->index_bits - cs->offset_bits;
+    cs->tag_bits = 64 - cs->index_bits - cs->offset_bits;
+    if (cs->tag_bits == 64) {
+        fprintf(stderr, "Cache geometry needs at least one index or offset bit.\n");
+        free(cs);
+        return NULL;
+    }
 
-    cs->offset_mask = 0xffffffff >> (32 - cs->offset_bits);
-    cs->set_index_mask = 0xffffffff >> cs->tag_bits;
+    cs->offset_mask = (UINT64_C(1) << cs->offset_bits) - 1;
+    cs->set_index_mask = (UINT64_C(1) << (cs->index_bits + cs->offset_bits)) - 1;
+    cs->verbosity = VERBOSITY_QUIET;
 
-    printf("\nCache System Geometry:\n");
-    printf("Index bits: %d\n", cs->index_bits);
-    printf("Offset bits: %d\n", cs->offset_bits);
-    printf("Tag bits: %d\n", cs->tag_bits);
-    printf("Offset mask: 0x%x\n", cs->offset_mask);
-    printf("Set index mask: 0x%x\n", cs->set_index_mask);
-
-    // We need to allocate an array of cache lines representing the cache lines
-    // across all of the sets in the cache. We are using a single 1-D array
-    // where every "cs->associativity"-sized block of elements represents one
-    // set.
+    // We need to allocate arrays representing the cache lines across all of
+    // the sets in the cache. We are using 1-D arrays where every
+    // "cs->associativity"-sized block of elements represents one set.
     //
     // For example, to access the 2nd element in the 3rd set (assuming
     // associativity = 4), you would access the element at index 3*4 + 1.
-    cs->cache_lines = calloc(cs->num_sets * cs->associativity, sizeof(struct cache_line));
+    //
+    // Caches whose lines would take more than cache_system_sparse_bytes()
+    // only allocate the sets that are touched, a page of sets at a time.
+    size_t num_lines = (size_t)cs->num_sets * cs->associativity;
+    if (num_lines * (sizeof(uint64_t) + sizeof(uint8_t)) >= cache_system_sparse_bytes()) {
+        cs->tags = NULL;
+        cs->states = NULL;
+        cs->sparse = sparse_sets_new(sets, associativity);
+    } else {
+        cs->tags = aligned_alloc(64, (num_lines * sizeof(uint64_t) + 63) & ~(size_t)63);
+        for (size_t i = 0; i < num_lines; i++) {
+            cs->tags[i] = CACHE_TAG_INVALID;
+        }
+        cs->states = calloc(num_lines, sizeof(uint8_t));
+        cs->sparse = NULL;
+    }
+    cs->valid_lines = 0;
+    cs->tag_lookup = tag_lookup_best();
+    cs->way_index = associativity >= cache_system_high_associativity()
+                        ? way_index_new(sets, associativity)
+                        : NULL;
+    cs->instrumentation = NULL;
+    cs->sampling = NULL;
+    cs->coalesce = false;
+    cs->coalesced_records = 0;
+    cs->coalesced_runs = 0;
+    cs->diagnostic = NULL;
+    cs->diagnostic_data = NULL;
     return cs;
 }
 
+uint32_t cache_system_high_associativity(void)
+{
+    const char *value = getenv("CACHESIM_HIGH_ASSOCIATIVITY");
+    if (value != NULL && atoi(value) > 0) {
+        return atoi(value);
+    }
+    return CACHE_SYSTEM_HIGH_ASSOCIATIVITY;
+}
+
+uint64_t cache_system_sparse_bytes(void)
+{
+    const char *value = getenv("CACHESIM_SPARSE_BYTES");
+    if (value != NULL && strtoull(value, NULL, 10) > 0) {
+        return strtoull(value, NULL, 10);
+    }
+    return CACHE_SYSTEM_SPARSE_BYTES;
+}
+
+// Report an error through the diagnostic callback, or on stderr outside the
+// library.
+static void cache_system_error(const struct cache_system *cache_system, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (cache_system->diagnostic == NULL) {
+#ifndef CACHESIM_LIBRARY
+        vfprintf(stderr, format, args);
+#endif
+    } else {
+        char message[256];
+        vsnprintf(message, sizeof(message), format, args);
+        cache_system->diagnostic(cache_system->diagnostic_data, message);
+    }
+    va_end(args);
+}
+
+#ifndef CACHESIM_LIBRARY
+void cache_system_print_geometry(struct cache_system *cs)
+{
+    printf("\nCache System Geometry:\n");
+    printf("Index bits: %d\n", cs->index_bits);
+    printf("Offset bits: %d\n", cs->offset_bits);
+    printf("Tag bits: %d\n", cs->tag_bits);
+    printf("Offset mask: 0x%" PRIx64 "\n", cs->offset_mask);
+    printf("Set index mask: 0x%" PRIx64 "\n", cs->set_index_mask);
+}
+#endif
+
 void cache_system_cleanup(struct cache_system *cache_system)
 {
-    free(cache_system->cache_lines);
-    cache_system->replacement_policy->cleanup(cache_system->replacement_policy);
-    free(cache_system->replacement_policy);
+    free(cache_system->tags);
+    free(cache_system->states);
+    if (cache_system->sparse != NULL) {
+        sparse_sets_cleanup(cache_system->sparse);
+    }
+    if (cache_system->way_index != NULL) {
+        way_index_cleanup(cache_system->way_index);
+    }
+    if (cache_system->instrumentation != NULL) {
+        instrumentation_cleanup(cache_system->instrumentation);
+    }
+    if (cache_system->sampling != NULL) {
+        set_sampling_cleanup(cache_system->sampling);
+    }
+    if (cache_system->replacement_policy != NULL) {
+        cache_system->replacement_policy->cleanup(cache_system->replacement_policy);
+        free(cache_system->replacement_policy);
+    }
 }
 
-int cache_system_mem_access(struct cache_system *cache_system, uint32_t address, char rw)
+// Access address. Demand accesses count towards the access, hit, and miss
+// statistics; other accesses (insertions of lines that were not requested,
+// see cache_system_insert) only count their dirty evictions. If outcome is not
+// NULL, it receives whether the access hit and which line it evicted.
+static inline int cache_system_access(struct cache_system *cache_system, uint64_t address, char rw,
+                                      bool demand, struct cache_system_outcome *outcome)
 {
-    cache_system->stats.accesses++;
+    if (demand) cache_system->stats.accesses++;
 
     uint32_t offset = (address & cache_system->offset_mask);
     uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
-    uint32_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
 
-    struct cache_line *cl = cache_system_find_cache_line(cache_system, set_idx, tag);
-    if (cl == NULL || cl->status == INVALID) { // cache miss
-        printf("  0x%x miss\n", address);
-        cache_system->stats.misses++;
+    bool trace = cache_system_tracing(cache_system);
 
-        // See if there's an open index.
-        int insert_index = -1;
-        int set_start = set_idx * cache_system->associativity;
-        struct cache_line *start = &cache_system->cache_lines[set_start];
-        for (int i = 0; start + i < start + cache_system->associativity; i++) {
-            // If the cache line is invalid, then we can use this index.
-            if ((start + i)->status == INVALID) {
-                insert_index = i;
-                break;
-            }
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    bool hit = way >= 0;
+    enum cache_status evicted = INVALID;
+    if (!hit) { // cache miss
+        cache_system_touch_set(cache_system, set_idx);
+        if (trace) printf("  0x%" PRIx64 " miss\n", address);
+        if (demand) cache_system->stats.misses++;
+        if (outcome != NULL) {
+            outcome->hit = false;
+            outcome->evicted_state = INVALID;
         }
 
+        // See if there's an open index.
+        int insert_index = cache_system_find_way(cache_system, set_idx, CACHE_TAG_INVALID);
+
         // The cache line is full, so we need to evict a cache line.
         if (insert_index < 0) {
             // An eviction is necessary. Call the replacement policy's eviction
@@ -81,33 +184,71 @@ int cache_system_mem_access(struct cache_system *cache_system, uint32_t address,
 
             // Check to ensure that the eviction index is within the set.
             if (evicted_index < 0 || cache_system->associativity <= evicted_index) {
-                fprintf(stderr, "Eviction index %d is outside of the set!", evicted_index);
+                cache_system_error(cache_system, "Eviction index %d is outside of the set!",
+                                   evicted_index);
                 return 1;
             }
 
             // Check if the eviction requires writeback.
-            struct cache_line evicted = cache_system->cache_lines[set_start + evicted_index];
-            if (evicted.status == MODIFIED) {
+            evicted = cache_system_set_states(cache_system, set_idx)[evicted_index];
+            if (evicted == MODIFIED) {
                 cache_system->stats.dirty_evictions++;
             }
 
-            printf("  evict %s cache line from set %d index %d\n",
-                   (evicted.status == MODIFIED ? "dirty" : "clean"), set_idx, evicted_index);
+            if (trace) {
+                printf("  evict %s cache line from set %d index %d\n",
+                       (evicted == MODIFIED ? "dirty" : "clean"), set_idx, evicted_index);
+            }
+
+            if (outcome != NULL) {
+                outcome->evicted_state = evicted;
+                outcome->evicted_address =
+                    (cache_system_set_tags(cache_system, set_idx)[evicted_index]
+                         << cache_system->index_bits |
+                     set_idx)
+                    << cache_system->offset_bits;
+            }
 
             // Use the evicted index as the insert index.
             insert_index = evicted_index;
+        } else {
+            cache_system->valid_lines++;
         }
 
-        printf("  store cache line with tag 0x%x in set %d index %d\n", tag, set_idx, insert_index);
+        if (trace) {
+            printf("  store cache line with tag 0x%" PRIx64 " in set %d index %d\n", tag,
+                   set_idx, insert_index);
+        }
 
-        // Change the tag of the cache line, and set cl to this cache line.
-        cl = &cache_system->cache_lines[set_start + insert_index];
-        cl->tag = tag;
-        cl->status = (rw == 'W') ? MODIFIED : EXCLUSIVE;
+        // Change the tag of the cache line, keeping the way index in sync.
+        struct way_index *index = cache_system->way_index;
+        uint64_t *set_tags = cache_system_set_tags(cache_system, set_idx);
+        if (index != NULL && set_tags[insert_index] != CACHE_TAG_INVALID) {
+            way_index_remove(index, set_tags, set_idx, insert_index);
+        }
+        set_tags[insert_index] = tag;
+        if (index != NULL) {
+            way_index_insert(index, set_tags, set_idx, insert_index);
+        }
+        cache_system_set_states(cache_system, set_idx)[insert_index] =
+            (rw == 'W') ? MODIFIED : EXCLUSIVE;
+        way = insert_index;
     } else { // cache hit
-        printf("  0x%x hit: set %d, tag 0x%x, offset %d\n", address, set_idx, tag, offset);
-        cache_system->stats.hits++;
-        if (rw == 'W') cl->status = MODIFIED;
+        if (trace) {
+            printf("  0x%" PRIx64 " hit: set %d, tag 0x%" PRIx64 ", offset %d\n", address, set_idx,
+                   tag, offset);
+        }
+        if (demand) cache_system->stats.hits++;
+        if (rw == 'W') cache_system_set_states(cache_system, set_idx)[way] = MODIFIED;
+        if (outcome != NULL) {
+            outcome->hit = true;
+            outcome->evicted_state = INVALID;
+        }
+    }
+
+    if (__builtin_expect(cache_system->instrumentation != NULL, 0)) {
+        instrumentation_record(cache_system->instrumentation, set_idx, way, demand, hit,
+                               evicted != INVALID, evicted == MODIFIED);
     }
 
     // Let the replacement policy know that the cache line was accessed.
@@ -118,17 +259,173 @@ int cache_system_mem_access(struct cache_system *cache_system, uint32_t address,
     return 0;
 }
 
-struct cache_line *cache_system_find_cache_line(struct cache_system *cache_system, uint32_t set_idx,
-                                                uint32_t tag)
+int cache_system_mem_access(struct cache_system *cache_system, uint64_t address, char rw)
+{
+    return cache_system_access(cache_system, address, rw, true, NULL);
+}
+
+int cache_system_mem_access_outcome(struct cache_system *cache_system, uint64_t address, char rw,
+                                    struct cache_system_outcome *outcome)
 {
-    // NOTE: Return a pointer to the cache line within the given set that has
-    // the given tag. If no such element exists, then return NULL.
-    int set_start = set_idx * cache_system->associativity;
-    struct cache_line *start = &cache_system->cache_lines[set_start];
-    for (int i = 0; start + i < start + cache_system->associativity; i++) {
-        if ((start + i)->tag == tag) {
-            return start + i;
+    return cache_system_access(cache_system, address, rw, true, outcome);
+}
+
+int cache_system_insert(struct cache_system *cache_system, uint64_t address, bool dirty,
+                        struct cache_system_outcome *outcome)
+{
+    return cache_system_access(cache_system, address, dirty ? 'W' : 'R', false, outcome);
+}
+
+enum cache_status cache_system_downgrade(struct cache_system *cache_system, uint64_t address)
+{
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return INVALID;
+
+    uint8_t *set_states = cache_system_set_states(cache_system, set_idx);
+    enum cache_status state = set_states[way];
+    set_states[way] = SHARED;
+
+    struct replacement_policy *policy = cache_system->replacement_policy;
+    if (state == MODIFIED && policy->clean != NULL) {
+        policy->clean(policy, cache_system, set_idx, way);
+    }
+    return state;
+}
+
+enum cache_status cache_system_invalidate(struct cache_system *cache_system, uint64_t address)
+{
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return INVALID;
+
+    uint64_t *set_tags = cache_system_set_tags(cache_system, set_idx);
+    uint8_t *set_states = cache_system_set_states(cache_system, set_idx);
+    enum cache_status state = set_states[way];
+    struct way_index *index = cache_system->way_index;
+    if (index != NULL) {
+        way_index_remove(index, set_tags, set_idx, way);
+        way_index_release(index, set_idx, way);
+    }
+    set_tags[way] = CACHE_TAG_INVALID;
+    set_states[way] = INVALID;
+    cache_system->valid_lines--;
+
+    struct replacement_policy *policy = cache_system->replacement_policy;
+    if (policy->invalidate != NULL) {
+        policy->invalidate(policy, cache_system, set_idx, way);
+    }
+    return state;
+}
+
+int cache_system_mem_access_run(struct cache_system *cache_system, uint64_t address, char rw,
+                                char rest_rw, uint64_t count)
+{
+    if (cache_system_access(cache_system, address, rw, true, NULL) != 0) return 1;
+    if (count == 1) return 0;
+
+    // The line is cached now, so the rest of the run hits. Only the second
+    // access can still make a difference to the policy (for example by
+    // promoting the line it just filled), and the line ends up dirty if any
+    // of them writes.
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    cache_system->stats.accesses += count - 1;
+    cache_system->stats.hits += count - 1;
+    if (rest_rw == 'W') {
+        int way = cache_system_find_way(cache_system, set_idx, tag);
+        cache_system_set_states(cache_system, set_idx)[way] = MODIFIED;
+    }
+    struct replacement_policy *policy = cache_system->replacement_policy;
+    policy->cache_access(policy, cache_system, set_idx, tag);
+    if (count > 2 && policy->repeat != NULL) {
+        policy->repeat(policy, cache_system, set_idx, tag, count - 2);
+    }
+    return 0;
+}
+
+// Perform the records in runs of the same line.
+static int cache_system_mem_access_coalesced(struct cache_system *cache_system,
+                                             const uint64_t *records, size_t count)
+{
+    // Records of the same line agree in every bit above the write flag and
+    // the offset.
+    uint32_t shift = cache_system->offset_bits + 1;
+    size_t i = 0;
+    while (i < count) {
+        uint64_t line = records[i] >> shift;
+        uint64_t rest_writes = 0;
+        size_t end = i + 1;
+        while (end < count && records[end] >> shift == line) {
+            rest_writes |= records[end] & TRACE_RECORD_WRITE;
+            end++;
+        }
+        if (cache_system_mem_access_run(cache_system, trace_record_address(records[i]),
+                                        trace_record_rw(records[i]), rest_writes ? 'W' : 'R',
+                                        end - i) != 0) {
+            return 1;
         }
+        cache_system->coalesced_runs++;
+        i = end;
     }
-    return NULL;
+    cache_system->coalesced_records += count;
+    return 0;
+}
+
+int cache_system_mem_access_batch(struct cache_system *cache_system, const uint64_t *records,
+                                  size_t count)
+{
+    if (cache_system->sampling != NULL) {
+        return set_sampling_mem_access_batch(cache_system, records, count);
+    }
+    if (cache_system->coalesce) {
+        return cache_system_mem_access_coalesced(cache_system, records, count);
+    }
+    struct replacement_policy *policy = cache_system->replacement_policy;
+    if (policy->access_batch != NULL && access_kernel_usable(cache_system)) {
+        return policy->access_batch(policy, cache_system, records, count);
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint64_t address = trace_record_address(records[i]);
+        char rw = trace_record_rw(records[i]);
+        if (cache_system_tracing(cache_system)) {
+            printf("%s at 0x%" PRIx64 "\n", (rw == 'R' ? "read" : "write"), address);
+        }
+        if (cache_system_mem_access(cache_system, address, rw) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int cache_system_mem_access_arrays(struct cache_system *cache_system, const uint64_t *addresses,
+                                   const uint8_t *writes, size_t count, uint64_t *hits,
+                                   uint64_t *dirty_evictions)
+{
+    size_t words = (count + 63) / 64;
+    if (hits != NULL) memset(hits, 0, words * sizeof(uint64_t));
+    if (dirty_evictions != NULL) memset(dirty_evictions, 0, words * sizeof(uint64_t));
+
+    bool outcomes = hits != NULL || dirty_evictions != NULL;
+    struct cache_system_outcome outcome;
+    for (size_t i = 0; i < count; i++) {
+        if (i + CACHE_SYSTEM_PREFETCH_DISTANCE < count) {
+            cache_system_prefetch(cache_system, addresses[i + CACHE_SYSTEM_PREFETCH_DISTANCE]);
+        }
+        char rw = writes != NULL && writes[i] ? 'W' : 'R';
+        if (cache_system_access(cache_system, addresses[i], rw, true,
+                                outcomes ? &outcome : NULL) != 0) {
+            return 1;
+        }
+        if (outcomes) {
+            uint64_t bit = UINT64_C(1) << (i % 64);
+            if (hits != NULL && outcome.hit) hits[i / 64] |= bit;
+            if (dirty_evictions != NULL && outcome.evicted_state == MODIFIED) {
+                dirty_evictions[i / 64] |= bit;
+            }
+        }
+    }
+    return 0;
 }
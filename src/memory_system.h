@@ -7,33 +7,69 @@
 #ifndef MEMORY_SYSTEM_H
 #define MEMORY_SYSTEM_H
 
+#include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+struct instrumentation;
 struct replacement_policy;
+struct set_sampling;
 #include "replacement_policies.h"
+#include "sparse_sets.h"
+#include "way_index.h"
 
 // This struct contains statistics about the cache performance.
 struct cache_system_stats {
-    uint32_t accesses;        // Total number of cache accesses
-    uint32_t hits;            // Total number of cache hits
-    uint32_t misses;          // Total number of cache misses
-    uint32_t dirty_evictions; // Total number of cache evictions requiring write-back
+    uint64_t accesses;        // Total number of cache accesses
+    uint64_t hits;            // Total number of cache hits
+    uint64_t misses;          // Total number of cache misses
+    uint64_t dirty_evictions; // Total number of cache evictions requiring write-back
 };
 
 // This enum keeps track of the status of each cache line in a set.
 enum cache_status {
     INVALID,   // The cache line is invalid.
-    EXCLUSIVE, // The cache line is valid, and held exclusively by the current processor (no
-               // multi-processors).
+    EXCLUSIVE, // The cache line is valid, and held exclusively by the current processor.
     MODIFIED,  // The cache line is valid, and modified (requires write-back).
+    SHARED,    // The cache line is valid and clean, and other processors may hold it too (only
+               // in the multi-core mode, see multicore.h).
 };
-struct cache_line {
-    uint32_t tag;
-    enum cache_status status;
+
+// The tag stored for invalid cache lines. Tags are at most 63 bits wide, so
+// no address has this tag and a tag comparison alone tells whether a line is a
+// hit.
+#define CACHE_TAG_INVALID UINT64_MAX
+
+// From this associativity on, the cache system finds lines through a per-set
+// hash index and LRU and LRU_PREFER_CLEAN keep their recency as linked lists
+// (see cache_system_high_associativity), so that every access is O(1) rather
+// than O(associativity).
+#define CACHE_SYSTEM_HIGH_ASSOCIATIVITY 32
+
+// From this many bytes of tags and states on, the lines are kept in sparse
+// set storage (see cache_system_sparse_bytes).
+#define CACHE_SYSTEM_SPARSE_BYTES (UINT64_C(64) << 20)
+
+// Batched accesses prefetch the set of the access this many positions ahead,
+// so that its tags are in the cache by the time it is simulated.
+#define CACHE_SYSTEM_PREFETCH_DISTANCE 8
+
+// Describes what a single access did, for callers that forward misses and
+// evictions to another cache (see hierarchy.h).
+struct cache_system_outcome {
+    bool hit;
+    enum cache_status evicted_state; // INVALID if no line was evicted.
+    uint64_t evicted_address;        // The address of the first byte of the evicted line.
+};
+
+// This enum controls how much the cache system prints while simulating.
+enum cache_system_verbosity {
+    VERBOSITY_QUIET,   // Nothing is printed by the cache system.
+    VERBOSITY_SUMMARY, // Only the geometry is printed; no per-access output.
+    VERBOSITY_FULL,    // Every access, hit, miss, eviction, and store is printed.
 };
 
 // This struct contains the data related to a cache system.
@@ -44,22 +80,178 @@ struct cache_system {
     // The cache state
     uint32_t line_size, num_sets, associativity;
     uint32_t index_bits, tag_bits, offset_bits;
-    struct cache_line *cache_lines; // Storing the cache lines in a flat array.
+
+    // The cache lines are stored as two flat arrays (structure-of-arrays): the
+    // tags, and the enum cache_status of every line. Every
+    // "associativity"-sized block of elements represents one set. Large caches
+    // keep them in a sparse_sets instead, and tags and states are NULL. Either
+    // way, they are reached through cache_system_set_tags and
+    // cache_system_set_states.
+    uint64_t *tags;
+    uint8_t *states;
+    struct sparse_sets *sparse;
+
+    // The number of lines that are not INVALID.
+    uint64_t valid_lines;
+
+    // Searches the tags of one set (see tag_lookup.h); chosen at construction
+    // time from the vector extensions the CPU supports.
+    int (*tag_lookup)(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+
+    // A hash index from tags to ways, used instead of tag_lookup when the
+    // associativity is high. NULL otherwise.
+    struct way_index *way_index;
+
+    // Per-set counters and histograms (see instrumentation.h), or NULL when
+    // they are not collected.
+    struct instrumentation *instrumentation;
+
+    // The sets that are simulated (see sampling.h), or NULL for all of them.
+    struct set_sampling *sampling;
+
+    // Whether cache_system_mem_access_batch coalesces runs of consecutive
+    // accesses to the same line, and how many records and runs it saw.
+    bool coalesce;
+    uint64_t coalesced_records, coalesced_runs;
 
     // Masks and shifts
-    uint32_t offset_mask, set_index_mask;
+    uint64_t offset_mask, set_index_mask;
+
+    // How much to print. Only VERBOSITY_FULL does any per-access formatting.
+    enum cache_system_verbosity verbosity;
+
+    // Receives error messages, for example from an embedding application
+    // (see libcachesim.h). When NULL, they are printed to stderr.
+    void (*diagnostic)(void *data, const char *message);
+    void *diagnostic_data;
 };
 
-// Create a new cache system.
+// Create a new cache system. Returns NULL (after printing an error) if the
+// geometry has no index or offset bits (so the tag would need all 64 bits).
 struct cache_system *cache_system_new(uint32_t line_size, uint32_t sets, uint32_t associativity);
 void cache_system_cleanup(struct cache_system *cache_system);
 
+// The associativity from which the O(1) structures are used. This is
+// CACHE_SYSTEM_HIGH_ASSOCIATIVITY unless the CACHESIM_HIGH_ASSOCIATIVITY
+// environment variable overrides it (for example, 1 to always use them).
+uint32_t cache_system_high_associativity(void);
+
+// The size of the tags and states from which a cache keeps them in sparse set
+// storage, allocating the sets as the trace first touches them. This is
+// CACHE_SYSTEM_SPARSE_BYTES unless the CACHESIM_SPARSE_BYTES environment
+// variable overrides it (for example, 1 to always use sparse storage). Both
+// kinds of storage give the same results.
+uint64_t cache_system_sparse_bytes(void);
+
+// Whether every access is printed. libcachesim is built with
+// CACHESIM_LIBRARY, which compiles the per-access output out: the library
+// never prints.
+static inline bool cache_system_tracing(const struct cache_system *cache_system)
+{
+#ifdef CACHESIM_LIBRARY
+    (void)cache_system;
+    return false;
+#else
+    return cache_system->verbosity == VERBOSITY_FULL;
+#endif
+}
+
+#ifndef CACHESIM_LIBRARY
+// Print the index/offset/tag breakdown of the cache system.
+void cache_system_print_geometry(struct cache_system *cache_system);
+#endif
+
 // Perform updates to access memory
-int cache_system_mem_access(struct cache_system *cache_system, uint32_t address, char rw);
+int cache_system_mem_access(struct cache_system *cache_system, uint64_t address, char rw);
+
+// Like cache_system_mem_access, but also describe the access in *outcome.
+int cache_system_mem_access_outcome(struct cache_system *cache_system, uint64_t address, char rw,
+                                    struct cache_system_outcome *outcome);
+
+// Place the line containing address in the cache (dirty or clean) without
+// counting an access, a hit, or a miss; a dirty eviction is still counted.
+// Used for lines that arrive without being requested, such as the victims an
+// exclusive cache receives from the level above it.
+int cache_system_insert(struct cache_system *cache_system, uint64_t address, bool dirty,
+                        struct cache_system_outcome *outcome);
+
+// Make the line containing address SHARED, if it is cached, as when another
+// processor reads it. Returns the state the line had (INVALID if it was not
+// cached); a MODIFIED line is written back by the caller.
+enum cache_status cache_system_downgrade(struct cache_system *cache_system, uint64_t address);
+
+// Invalidate the line containing address, if it is cached. Returns the state
+// the line had (INVALID if it was not cached).
+enum cache_status cache_system_invalidate(struct cache_system *cache_system, uint64_t address);
+
+// Perform count accesses to the line of address in a row: the first with rw,
+// and the others, which all hit, with rest_rw ('W' if any of them writes).
+// After the first two, the accesses cannot change the state of the line or of
+// the replacement policy (other than through its repeat hook), so they are
+// only counted. The results are exactly those of performing the accesses one
+// by one, except for per-access output and instrumentation.
+int cache_system_mem_access_run(struct cache_system *cache_system, uint64_t address, char rw,
+                                char rest_rw, uint64_t count);
+
+// Perform every access in an array of packed trace records (see trace.h),
+// stopping at the first failure. With coalesce, every run of consecutive
+// records of the same line is performed by cache_system_mem_access_run.
+int cache_system_mem_access_batch(struct cache_system *cache_system, const uint64_t *records,
+                                  size_t count);
+
+// Perform count accesses given as separate arrays of addresses and of write
+// flags (NULL for reads only). If hits or dirty_evictions is not NULL, bit i
+// of that bitmap ((count + 63) / 64 words) is set when access i hit or caused
+// a dirty eviction. Stops at the first failure.
+int cache_system_mem_access_arrays(struct cache_system *cache_system, const uint64_t *addresses,
+                                   const uint8_t *writes, size_t count, uint64_t *hits,
+                                   uint64_t *dirty_evictions);
+
+// The tags and the states of the lines of set_idx. They may only be written
+// once the set has been touched with cache_system_touch_set.
+static inline uint64_t *cache_system_set_tags(const struct cache_system *cache_system,
+                                              uint32_t set_idx)
+{
+    if (cache_system->sparse != NULL) return sparse_sets_tags(cache_system->sparse, set_idx);
+    return &cache_system->tags[(size_t)set_idx * cache_system->associativity];
+}
+
+static inline uint8_t *cache_system_set_states(const struct cache_system *cache_system,
+                                               uint32_t set_idx)
+{
+    if (cache_system->sparse != NULL) return sparse_sets_states(cache_system->sparse, set_idx);
+    return &cache_system->states[(size_t)set_idx * cache_system->associativity];
+}
+
+// Make the lines of set_idx writable. Only sparse storage has anything to do.
+static inline void cache_system_touch_set(struct cache_system *cache_system, uint32_t set_idx)
+{
+    if (cache_system->sparse != NULL) sparse_sets_touch(cache_system->sparse, set_idx);
+}
+
+// Start loading the tags (or the way index) of the set of address.
+static inline void cache_system_prefetch(const struct cache_system *cache_system, uint64_t address)
+{
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    if (cache_system->way_index != NULL) {
+        const struct way_index *index = cache_system->way_index;
+        __builtin_prefetch(&index->slots[(size_t)set_idx * index->capacity]);
+    } else {
+        __builtin_prefetch(cache_system_set_tags(cache_system, set_idx));
+    }
+}
 
-// Returns a pointer to the cache line within the given set that has the given
-// tag. If no such element exists, then return NULL.
-struct cache_line *cache_system_find_cache_line(struct cache_system *cache_system, uint32_t set_idx,
-                                                uint32_t tag);
+// Returns the index within the given set of the cache line that has the given
+// tag. If no such line exists, then return -1. Passing CACHE_TAG_INVALID finds
+// the first invalid line.
+static inline int cache_system_find_way(const struct cache_system *cache_system,
+                                        uint32_t set_idx, uint64_t tag)
+{
+    const uint64_t *set_tags = cache_system_set_tags(cache_system, set_idx);
+    if (cache_system->way_index != NULL) {
+        return way_index_find(cache_system->way_index, set_tags, set_idx, tag);
+    }
+    return cache_system->tag_lookup(set_tags, cache_system->associativity, tag);
+}
 
 #endif
@@ -0,0 +1,487 @@
+//
+// This file contains the implementation of the multi-core mode defined in
+// multicore.h.
+//
+// The directory maps every line that some core holds to the set of cores
+// holding it (a bitmask, so there are at most MULTICORE_MAX_CORES cores). The
+// states of the copies themselves live in the cores' caches: a line held by
+// one core is EXCLUSIVE or MODIFIED there, and a line held by several cores is
+// SHARED in all of them.
+//
+// A core performs its misses and upgrades in its own cache during the parallel
+// phase, as if it held the line alone, and queues a directory request for each
+// of them. The serial phase then applies the requests of all cores in the
+// order of their positions in the traces (and of the core ids for the same
+// position): it updates the directory, and invalidates or downgrades the
+// other copies as of that position. A copy that its core filled again, or
+// upgraded, later in the epoch is left alone: that later request of its own
+// comes after this one, and an upgrade whose line was taken away meanwhile
+// counts as a miss.
+//
+
+#include "multicore.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "line_map.h"
+#include "memory_system.h"
+#include "replacement_policies.h"
+#include "trace.h"
+
+#define MULTICORE_MAX_CORES 64
+
+// The default number of accesses a core may simulate per epoch.
+#define MULTICORE_EPOCH_SIZE 1024
+
+// An access of a core that needs the directory: a miss, or a write to a SHARED
+// line (an upgrade).
+struct directory_request {
+    size_t position; // In the core's trace.
+    uint64_t address;
+    uint64_t evicted_address;
+    char rw;
+    bool upgrade;
+    bool evicted; // Whether the access evicted the line at evicted_address.
+};
+
+// Coherence statistics of one core, on top of its cache_system_stats.
+struct core_stats {
+    uint64_t sharing_misses;         // Misses on lines another core's write took away.
+    uint64_t upgrades;               // Writes to SHARED lines.
+    uint64_t invalidations_sent;     // Copies of other cores invalidated by this core.
+    uint64_t invalidations_received; // Copies of this core invalidated by other cores.
+    uint64_t interventions;          // MODIFIED lines supplied to another core.
+};
+
+struct core {
+    pthread_t thread;
+    struct multicore *multicore;
+    unsigned id;
+    struct cache_system *cache_system;
+    struct trace trace;
+
+    // The next record of the trace to simulate, and whether simulating one
+    // failed.
+    size_t position;
+    bool failed;
+
+    // The directory requests of the current epoch, in the order of their
+    // positions, and the positions of the last fill and of the last upgrade of
+    // every line the core requested in the epoch.
+    struct directory_request *requests;
+    size_t num_requests, requests_capacity;
+    struct line_map fills, upgrades;
+
+    struct core_stats stats;
+
+    // The lines another core's write invalidated here, with a value of 1
+    // until the next miss on them.
+    struct line_map lost;
+};
+
+struct multicore {
+    struct core *cores;
+    unsigned num_cores;
+    size_t epoch_size;
+    uint32_t offset_bits;
+
+    // Line address -> bitmask of the cores that hold the line.
+    struct line_map directory;
+
+    // The parallel phase of every epoch runs between start and end.
+    pthread_barrier_t start, end;
+    bool finished;
+    uint64_t epochs;
+};
+
+static void multicore_usage(void)
+{
+    fprintf(stderr, "Usage: cachesim multicore [-v quiet|summary] [-e epoch_size] [-S seed] "
+                    "<policy>\n"
+                    "                          <cache_size> <cache_lines> <associativity>\n"
+                    "                          <core0_trace> [<core1_trace> ...]\n");
+}
+
+static bool is_power_of_two(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// Whether an access needs the directory: a miss, or a write to a line that
+// other cores may share.
+static bool core_needs_directory(const struct cache_system *cache_system, uint64_t address,
+                                 char rw)
+{
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    uint64_t tag = address >> (cache_system->offset_bits + cache_system->index_bits);
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return true;
+    return rw == 'W' && cache_system_set_states(cache_system, set_idx)[way] == SHARED;
+}
+
+// The parallel phase of an epoch: simulate the epoch's accesses in the core's
+// own cache, and queue the ones that need the directory.
+static void core_run(struct core *core)
+{
+    struct cache_system *cache_system = core->cache_system;
+    size_t end = core->position + core->multicore->epoch_size;
+    if (end > core->trace.count) end = core->trace.count;
+
+    for (; core->position < end; core->position++) {
+        uint64_t record = core->trace.records[core->position];
+        uint64_t address = trace_record_address(record);
+        char rw = trace_record_rw(record);
+        if (!core_needs_directory(cache_system, address, rw)) {
+            if (cache_system_mem_access(cache_system, address, rw) != 0) {
+                core->failed = true;
+                return;
+            }
+            continue;
+        }
+
+        if (core->num_requests == core->requests_capacity) {
+            core->requests_capacity = core->requests_capacity ? 2 * core->requests_capacity : 64;
+            core->requests = realloc(core->requests,
+                                     core->requests_capacity * sizeof(struct directory_request));
+        }
+        struct directory_request *request = &core->requests[core->num_requests++];
+        struct cache_system_outcome outcome;
+        if (cache_system_mem_access_outcome(cache_system, address, rw, &outcome) != 0) {
+            core->failed = true;
+            return;
+        }
+        request->position = core->position;
+        request->address = address;
+        request->rw = rw;
+        request->upgrade = outcome.hit;
+        request->evicted = outcome.evicted_state != INVALID;
+        request->evicted_address = outcome.evicted_address;
+        bool inserted;
+        uint64_t line = address >> core->multicore->offset_bits;
+        *line_map_insert(outcome.hit ? &core->upgrades : &core->fills, line, &inserted) =
+            core->position;
+    }
+}
+
+static void *core_main(void *arg)
+{
+    struct core *core = arg;
+    struct multicore *multicore = core->multicore;
+    for (;;) {
+        pthread_barrier_wait(&multicore->start);
+        if (multicore->finished) break;
+        core_run(core);
+        pthread_barrier_wait(&multicore->end);
+    }
+    return NULL;
+}
+
+// How a request at position sees the copy of a line that core holds now,
+// given what core did to it later in the epoch (at the same position, the
+// core with the higher id comes later).
+enum copy_age {
+    COPY_CURRENT,  // The copy as it is now.
+    COPY_REFILLED, // A copy filled later; the one at position was evicted first.
+    COPY_UPGRADED, // The copy, which was SHARED at position and is upgraded later.
+};
+
+static enum copy_age core_copy_age(const struct core *core, uint64_t line, size_t position,
+                                   unsigned requester)
+{
+    uint64_t *fill = line_map_find((struct line_map *)&core->fills, line);
+    if (fill != NULL && (*fill > position || (*fill == position && core->id > requester))) {
+        return COPY_REFILLED;
+    }
+    uint64_t *upgrade = line_map_find((struct line_map *)&core->upgrades, line);
+    if (upgrade != NULL &&
+        (*upgrade > position || (*upgrade == position && core->id > requester))) {
+        return COPY_UPGRADED;
+    }
+    return COPY_CURRENT;
+}
+
+// The serial phase: apply request of core to the directory and to the copies
+// of the other cores.
+static void directory_serve(struct multicore *multicore, struct core *core,
+                            const struct directory_request *request)
+{
+    uint64_t address = request->address;
+    char rw = request->rw;
+    uint64_t line = address >> multicore->offset_bits;
+    uint64_t self = UINT64_C(1) << core->id;
+    bool upgrade = request->upgrade;
+
+    bool inserted;
+    uint64_t *sharers = line_map_insert(&multicore->directory, line, &inserted);
+
+    // Another core's write took the line away before this upgrade (but left
+    // the copy in place, see below), so the write is a miss that fetches the
+    // line again into the same way.
+    if (upgrade && !(*sharers & self)) {
+        core->cache_system->stats.hits--;
+        core->cache_system->stats.misses++;
+        upgrade = false;
+    }
+
+    if (!upgrade) {
+        uint64_t *lost = line_map_find(&core->lost, line);
+        if (lost != NULL && *lost) {
+            core->stats.sharing_misses++;
+            *lost = 0;
+        }
+    }
+
+    uint64_t others = *sharers & ~self;
+    for (unsigned o = 0; others != 0; o++, others >>= 1) {
+        if (!(others & 1)) continue;
+        struct core *other = &multicore->cores[o];
+        enum copy_age age = core_copy_age(other, line, request->position, core->id);
+        enum cache_status state = INVALID;
+        if (rw == 'W') {
+            // Read for ownership (or upgrade): every other copy goes away. A
+            // copy that is upgraded later stays, as that upgrade fetches it
+            // again.
+            if (age == COPY_CURRENT) {
+                state = cache_system_invalidate(other->cache_system, address);
+            }
+            other->stats.invalidations_received++;
+            core->stats.invalidations_sent++;
+            bool lost_inserted;
+            *line_map_insert(&other->lost, line, &lost_inserted) = 1;
+        } else if (age == COPY_CURRENT) {
+            // Read: other copies become SHARED.
+            state = cache_system_downgrade(other->cache_system, address);
+        }
+        if (state == MODIFIED) other->stats.interventions++;
+    }
+
+    if (upgrade) core->stats.upgrades++;
+    bool shared = rw == 'R' && (*sharers & ~self);
+    *sharers = rw == 'W' ? self : *sharers | self;
+    if (shared && core_copy_age(core, line, request->position, core->id) == COPY_CURRENT) {
+        cache_system_downgrade(core->cache_system, address);
+    }
+    if (request->evicted) {
+        uint64_t evicted_line = request->evicted_address >> multicore->offset_bits;
+        uint64_t *evicted_sharers = line_map_find(&multicore->directory, evicted_line);
+        if (evicted_sharers != NULL) *evicted_sharers &= ~self;
+    }
+}
+
+// The serial phase of an epoch: serve the requests of all cores in the order
+// of their positions, then of the core ids.
+static void multicore_resolve(struct multicore *multicore)
+{
+    size_t next[MULTICORE_MAX_CORES] = {0};
+    for (;;) {
+        struct core *first = NULL;
+        for (unsigned c = 0; c < multicore->num_cores; c++) {
+            struct core *core = &multicore->cores[c];
+            if (next[c] == core->num_requests) continue;
+            if (first == NULL || core->requests[next[c]].position <
+                                     first->requests[next[first->id]].position) {
+                first = core;
+            }
+        }
+        if (first == NULL) break;
+        directory_serve(multicore, first, &first->requests[next[first->id]++]);
+    }
+    for (unsigned c = 0; c < multicore->num_cores; c++) {
+        multicore->cores[c].num_requests = 0;
+        line_map_clear(&multicore->cores[c].fills);
+        line_map_clear(&multicore->cores[c].upgrades);
+    }
+}
+
+static void multicore_print(const struct multicore *multicore)
+{
+    for (unsigned c = 0; c < multicore->num_cores; c++) {
+        const struct core *core = &multicore->cores[c];
+        const struct cache_system_stats *stats = &core->cache_system->stats;
+        printf("OUTPUT CORE %u ACCESSES %" PRIu64 "\n", c, stats->accesses);
+        printf("OUTPUT CORE %u HITS %" PRIu64 "\n", c, stats->hits);
+        printf("OUTPUT CORE %u MISSES %" PRIu64 "\n", c, stats->misses);
+        printf("OUTPUT CORE %u SHARING MISSES %" PRIu64 "\n", c, core->stats.sharing_misses);
+        printf("OUTPUT CORE %u UPGRADES %" PRIu64 "\n", c, core->stats.upgrades);
+        printf("OUTPUT CORE %u DIRTY EVICTIONS %" PRIu64 "\n", c, stats->dirty_evictions);
+        printf("OUTPUT CORE %u INVALIDATIONS SENT %" PRIu64 "\n", c,
+               core->stats.invalidations_sent);
+        printf("OUTPUT CORE %u INVALIDATIONS RECEIVED %" PRIu64 "\n", c,
+               core->stats.invalidations_received);
+        printf("OUTPUT CORE %u INTERVENTIONS %" PRIu64 "\n", c, core->stats.interventions);
+        printf("OUTPUT CORE %u HIT RATIO %.8f\n", c,
+               stats->accesses ? (double)stats->hits / stats->accesses : 0.0);
+    }
+    printf("OUTPUT EPOCHS %" PRIu64 "\n", multicore->epochs);
+}
+
+int multicore_main(int argc, char **argv)
+{
+    struct multicore multicore = {0};
+    multicore.epoch_size = MULTICORE_EPOCH_SIZE;
+    enum cache_system_verbosity verbosity = VERBOSITY_SUMMARY;
+    uint64_t seed = REPLACEMENT_POLICY_DEFAULT_SEED;
+
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "hv:e:S:")) != -1) {
+        switch (opt) {
+        case 'h':
+            multicore_usage();
+            return 0;
+        case 'v':
+            if (!strcmp("quiet", optarg)) {
+                verbosity = VERBOSITY_QUIET;
+            } else if (!strcmp("summary", optarg)) {
+                verbosity = VERBOSITY_SUMMARY;
+            } else {
+                fprintf(stderr, "Unknown verbosity %s (the multi-core mode supports quiet and "
+                                "summary)\n",
+                        optarg);
+                return 1;
+            }
+            break;
+        case 'e':
+            multicore.epoch_size = strtoul(optarg, NULL, 10);
+            if (multicore.epoch_size < 1) {
+                fprintf(stderr, "The epoch size must be at least 1.\n");
+                return 1;
+            }
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            multicore_usage();
+            return 1;
+        }
+    }
+    if (argc - optind < 5) {
+        multicore_usage();
+        return 1;
+    }
+    const char *policy = argv[optind];
+    size_t cache_size = strtoul(argv[optind + 1], NULL, 10);
+    size_t cache_lines = strtoul(argv[optind + 2], NULL, 10);
+    size_t associativity = strtoul(argv[optind + 3], NULL, 10);
+    multicore.num_cores = argc - optind - 4;
+    if (multicore.num_cores > MULTICORE_MAX_CORES) {
+        fprintf(stderr, "At most %d cores are supported.\n", MULTICORE_MAX_CORES);
+        return 1;
+    }
+    if (cache_lines == 0 || associativity == 0 || cache_size % cache_lines != 0 ||
+        cache_lines % associativity != 0 || !is_power_of_two(cache_size / cache_lines) ||
+        !is_power_of_two(cache_lines / associativity)) {
+        fprintf(stderr, "Invalid cache geometry %zu %zu %zu\n", cache_size, cache_lines,
+                associativity);
+        return 1;
+    }
+    uint32_t line_size = cache_size / cache_lines;
+    uint32_t sets = cache_lines / associativity;
+    multicore.offset_bits = __builtin_ctz(line_size);
+
+    if (verbosity >= VERBOSITY_SUMMARY) {
+        printf("Multi-core Info\n");
+        printf("===============\n");
+        printf("Replacement Policy: %s\n", policy);
+        printf("Cache Size: %zu\n", cache_size);
+        printf("Cache Lines: %zu\n", cache_lines);
+        printf("Associativity: %zu\n", associativity);
+        printf("Cores: %u\n", multicore.num_cores);
+        printf("Epoch Size: %zu\n\n", multicore.epoch_size);
+    }
+
+    // Create the cores and load their traces.
+    int ret = 1;
+    unsigned num_created = 0;
+    multicore.cores = calloc(multicore.num_cores, sizeof(struct core));
+    line_map_init(&multicore.directory, 1024);
+    for (; num_created < multicore.num_cores; num_created++) {
+        struct core *core = &multicore.cores[num_created];
+        core->multicore = &multicore;
+        core->id = num_created;
+        line_map_init(&core->lost, 16);
+        line_map_init(&core->fills, 16);
+        line_map_init(&core->upgrades, 16);
+        if (trace_load(argv[optind + 4 + num_created], &core->trace) != 0) break;
+
+        core->cache_system = cache_system_new(line_size, sets, associativity);
+        if (core->cache_system == NULL) {
+            trace_cleanup(&core->trace);
+            break;
+        }
+        // Every core gets its own seed, so that their RAND victims are
+        // independent.
+        core->cache_system->replacement_policy =
+            replacement_policy_new(policy, sets, associativity, seed + num_created);
+        if (core->cache_system->replacement_policy == NULL) {
+            fprintf(stderr, "Unknown replacement policy %s\n", policy);
+            cache_system_cleanup(core->cache_system);
+            free(core->cache_system);
+            trace_cleanup(&core->trace);
+            break;
+        }
+    }
+    if (num_created < multicore.num_cores) {
+        line_map_cleanup(&multicore.cores[num_created].lost);
+        line_map_cleanup(&multicore.cores[num_created].fills);
+        line_map_cleanup(&multicore.cores[num_created].upgrades);
+        goto out;
+    }
+
+    pthread_barrier_init(&multicore.start, NULL, multicore.num_cores + 1);
+    pthread_barrier_init(&multicore.end, NULL, multicore.num_cores + 1);
+    for (unsigned c = 0; c < multicore.num_cores; c++) {
+        pthread_create(&multicore.cores[c].thread, NULL, core_main, &multicore.cores[c]);
+    }
+
+    int status = 0;
+    for (;;) {
+        bool done = true;
+        for (unsigned c = 0; c < multicore.num_cores; c++) {
+            if (multicore.cores[c].position < multicore.cores[c].trace.count) done = false;
+        }
+        if (done || status != 0) {
+            multicore.finished = true;
+            pthread_barrier_wait(&multicore.start);
+            break;
+        }
+
+        pthread_barrier_wait(&multicore.start);
+        pthread_barrier_wait(&multicore.end);
+        for (unsigned c = 0; c < multicore.num_cores; c++) {
+            if (multicore.cores[c].failed) status = 1;
+        }
+        if (status == 0) multicore_resolve(&multicore);
+        multicore.epochs++;
+    }
+    for (unsigned c = 0; c < multicore.num_cores; c++) {
+        pthread_join(multicore.cores[c].thread, NULL);
+    }
+    pthread_barrier_destroy(&multicore.start);
+    pthread_barrier_destroy(&multicore.end);
+
+    if (status == 0) {
+        multicore_print(&multicore);
+        ret = 0;
+    }
+
+out:
+    for (unsigned c = 0; c < num_created; c++) {
+        struct core *core = &multicore.cores[c];
+        cache_system_cleanup(core->cache_system);
+        free(core->cache_system);
+        trace_cleanup(&core->trace);
+        line_map_cleanup(&core->lost);
+        line_map_cleanup(&core->fills);
+        line_map_cleanup(&core->upgrades);
+        free(core->requests);
+    }
+    line_map_cleanup(&multicore.directory);
+    free(multicore.cores);
+    return ret;
+}
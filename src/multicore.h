@@ -0,0 +1,25 @@
+//
+// This file defines the multi-core mode, which simulates one private cache per
+// core, kept coherent with the MESI protocol by a directory, with one trace
+// per core.
+//
+// The cores advance in epochs. In the parallel phase of an epoch, every core
+// simulates the epoch's worth of accesses in its own cache on its own thread,
+// and queues the accesses that need the directory (misses, and writes to
+// SHARED lines) with their positions. In the serial phase that follows, the
+// directory serves the queued requests of all cores in the order of their
+// positions (and of the core ids for the same position), invalidating and
+// downgrading the copies of other cores. Coherence actions therefore reach the
+// other cores at the end of the epoch: within an epoch, a core can still hit
+// on a line that another core's write has taken away. Smaller epochs are more
+// precise and larger ones run more in parallel; either way, the results do not
+// depend on thread timing.
+//
+
+#ifndef MULTICORE_H
+#define MULTICORE_H
+
+// The entrypoint of "cachesim multicore". argv[0] is "multicore".
+int multicore_main(int argc, char **argv);
+
+#endif
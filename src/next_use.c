@@ -0,0 +1,89 @@
+//
+// This file contains the implementations for the functions defined in
+// next_use.h.
+//
+
+#include "next_use.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "line_map.h"
+
+// Create an unlinked temporary file of size bytes. Returns its descriptor, or
+// -1 after printing an error.
+static int next_use_tmpfile(size_t size)
+{
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') dir = "/tmp";
+    size_t length = strlen(dir) + sizeof("/cachesim-opt-XXXXXX");
+    char *path = malloc(length);
+    snprintf(path, length, "%s/cachesim-opt-XXXXXX", dir);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    unlink(path);
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        fd = -1;
+    }
+    free(path);
+    return fd;
+}
+
+struct next_use *next_use_build(const struct trace *trace, uint32_t line_size)
+{
+    struct next_use *next_use = calloc(1, sizeof(struct next_use));
+    next_use->count = trace->count;
+    if (trace->count == 0) return next_use;
+
+    size_t size = trace->count * sizeof(uint64_t);
+    int fd = next_use_tmpfile(size);
+    if (fd < 0) {
+        free(next_use);
+        return NULL;
+    }
+    uint64_t *positions = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (positions == MAP_FAILED) {
+        fprintf(stderr, "Cannot map the next-use index: %s\n", strerror(errno));
+        free(next_use);
+        return NULL;
+    }
+
+    // Walk the trace from the end, remembering the position at which every
+    // line is used next.
+    uint32_t offset_bits = __builtin_ctz(line_size);
+    struct line_map map;
+    line_map_init(&map, 1024);
+    for (size_t i = trace->count; i-- > 0;) {
+        uint64_t line = trace_record_address(trace->records[i]) >> offset_bits;
+        bool inserted;
+        uint64_t *next = line_map_insert(&map, line, &inserted);
+        positions[i] = inserted ? NEXT_USE_NEVER : *next;
+        *next = i;
+    }
+    line_map_cleanup(&map);
+
+    madvise(positions, size, MADV_SEQUENTIAL);
+    next_use->positions = positions;
+    return next_use;
+}
+
+void next_use_cleanup(struct next_use *next_use)
+{
+    if (next_use->positions != NULL) {
+        munmap((void *)next_use->positions, next_use->count * sizeof(uint64_t));
+    }
+    free(next_use);
+}
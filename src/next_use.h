@@ -0,0 +1,34 @@
+//
+// This file defines the next-use index of a trace, which the OPT replacement
+// policy uses to look into the future: for every access, the position of the
+// next access to the same cache line.
+//
+// The index is built by a single backward pass over the trace, with a
+// line_map from each line to the position at which it is used next. It holds
+// one 64-bit position per access, so it lives in an unlinked temporary file
+// (in $TMPDIR, or /tmp) that is memory-mapped: the kernel can write it out
+// instead of keeping it in memory when the trace is too large for RAM.
+//
+
+#ifndef NEXT_USE_H
+#define NEXT_USE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+// The next use of a line that is never used again.
+#define NEXT_USE_NEVER UINT64_MAX
+
+struct next_use {
+    const uint64_t *positions; // Per access: the position of the next use of its line.
+    size_t count;
+};
+
+// Build the next-use index of trace for lines of line_size bytes. Returns
+// NULL (after printing an error) if the temporary file cannot be created.
+struct next_use *next_use_build(const struct trace *trace, uint32_t line_size);
+void next_use_cleanup(struct next_use *next_use);
+
+#endif
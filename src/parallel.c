@@ -0,0 +1,180 @@
+//
+// This file contains the implementation of the set-partitioned parallel
+// simulation defined in parallel.h.
+//
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "instrumentation.h"
+#include "sampling.h"
+
+// The capacity of each ring, in records. Must be a power of two.
+#define RING_CAPACITY (1 << 16)
+
+// The dispatcher stages this many records per worker before publishing them,
+// so the ring indices are only touched once per chunk.
+#define RING_CHUNK 256
+
+// A single-producer/single-consumer ring of trace records. The head is only
+// written by the consumer and the tail only by the producer; they are kept on
+// separate cache lines so the two threads do not false-share.
+struct ring {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) uint64_t records[RING_CAPACITY];
+};
+
+struct worker {
+    pthread_t thread;
+    struct ring ring;
+    atomic_bool done; // Set by the dispatcher after the last record is published.
+
+    // A private copy of the cache system. It shares the cache lines and the
+    // replacement policy with every other worker, but has its own statistics.
+    struct cache_system cache_system;
+    int status;
+
+    // Records staged by the dispatcher that have not been published yet.
+    uint64_t staged[RING_CHUNK];
+    size_t num_staged;
+};
+
+static void ring_push(struct ring *ring, const uint64_t *records, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail + count - atomic_load_explicit(&ring->head, memory_order_acquire) >
+           RING_CAPACITY) {
+        sched_yield();
+    }
+    for (size_t i = 0; i < count; i++) {
+        ring->records[(tail + i) & (RING_CAPACITY - 1)] = records[i];
+    }
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+static int worker_mem_access(struct cache_system *cache_system, uint64_t record)
+{
+    uint64_t address = trace_record_address(record);
+    char rw = trace_record_rw(record);
+    if (cache_system->sampling == NULL) {
+        return cache_system_mem_access(cache_system, address, rw);
+    }
+
+    // The dispatcher only hands out accesses to sampled sets, and every worker
+    // owns different sets, so the per-set statistics can be shared.
+    struct cache_system_outcome outcome;
+    int status = cache_system_mem_access_outcome(cache_system, address, rw, &outcome);
+    uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+    set_sampling_record(cache_system->sampling, set_idx, &outcome);
+    return status;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *worker = arg;
+    struct ring *ring = &worker->ring;
+    size_t head = 0;
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (tail == head) {
+            if (atomic_load_explicit(&worker->done, memory_order_acquire) &&
+                atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        for (; head != tail; head++) {
+            uint64_t record = ring->records[head & (RING_CAPACITY - 1)];
+            // After a failure, keep draining the ring so the dispatcher never
+            // blocks, but stop simulating.
+            if (worker->status == 0) {
+                worker->status = worker_mem_access(&worker->cache_system, record);
+            }
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    return NULL;
+}
+
+static void worker_publish(struct worker *worker)
+{
+    ring_push(&worker->ring, worker->staged, worker->num_staged);
+    worker->num_staged = 0;
+}
+
+int parallel_mem_access(struct cache_system *cache_system, struct trace_reader *reader,
+                        unsigned num_workers)
+{
+    if (num_workers > cache_system->num_sets) {
+        num_workers = cache_system->num_sets;
+    }
+
+    struct worker *workers = aligned_alloc(64, num_workers * sizeof(struct worker));
+    for (unsigned w = 0; w < num_workers; w++) {
+        struct worker *worker = &workers[w];
+        atomic_init(&worker->ring.head, 0);
+        atomic_init(&worker->ring.tail, 0);
+        atomic_init(&worker->done, false);
+        worker->cache_system = *cache_system;
+        memset(&worker->cache_system.stats, 0, sizeof(struct cache_system_stats));
+        worker->cache_system.valid_lines = 0;
+        if (cache_system->instrumentation != NULL) {
+            worker->cache_system.instrumentation =
+                instrumentation_fork(cache_system->instrumentation);
+        }
+        worker->status = 0;
+        worker->num_staged = 0;
+        pthread_create(&worker->thread, NULL, worker_main, worker);
+    }
+
+    // Worker w owns sets [w * num_sets / num_workers, (w + 1) * num_sets / num_workers).
+    struct set_sampling *sampling = cache_system->sampling;
+    const uint64_t *records;
+    ssize_t count;
+    while ((count = trace_reader_next_batch(reader, &records)) > 0) {
+        if (sampling != NULL) sampling->accesses += count;
+        for (ssize_t i = 0; i < count; i++) {
+            uint64_t address = trace_record_address(records[i]);
+            uint64_t set_idx =
+                (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+            if (sampling != NULL && !set_sampling_contains(sampling, set_idx)) continue;
+            struct worker *worker = &workers[(set_idx * num_workers) >> cache_system->index_bits];
+            worker->staged[worker->num_staged++] = records[i];
+            if (worker->num_staged == RING_CHUNK) {
+                worker_publish(worker);
+            }
+        }
+    }
+
+    int status = count < 0;
+    for (unsigned w = 0; w < num_workers; w++) {
+        worker_publish(&workers[w]);
+        atomic_store_explicit(&workers[w].done, true, memory_order_release);
+    }
+    for (unsigned w = 0; w < num_workers; w++) {
+        struct worker *worker = &workers[w];
+        pthread_join(worker->thread, NULL);
+        status |= worker->status;
+
+        cache_system->stats.accesses += worker->cache_system.stats.accesses;
+        cache_system->stats.hits += worker->cache_system.stats.hits;
+        cache_system->stats.misses += worker->cache_system.stats.misses;
+        cache_system->stats.dirty_evictions += worker->cache_system.stats.dirty_evictions;
+        cache_system->valid_lines += worker->cache_system.valid_lines;
+        if (cache_system->instrumentation != NULL) {
+            instrumentation_join(cache_system->instrumentation,
+                                 worker->cache_system.instrumentation);
+        }
+    }
+
+    free(workers);
+    return status;
+}
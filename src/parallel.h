@@ -0,0 +1,26 @@
+//
+// This file defines the set-partitioned parallel simulation of a single cache
+// configuration.
+//
+// The sets of a cache are independent under the replacement policies in this
+// simulator: an access only reads and writes the cache lines and policy state
+// of its own set. The calling thread therefore acts as a dispatcher that
+// computes the set of every access and routes it through a lock-free
+// single-producer/single-consumer ring to the worker thread that owns that
+// set. Each worker owns a contiguous range of sets and keeps its own
+// statistics, which are merged into the cache system at the end.
+//
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "memory_system.h"
+#include "trace.h"
+
+// Simulate every access from reader on cache_system using num_workers worker
+// threads. The cache system must not print per-access output. Returns 0 on
+// success.
+int parallel_mem_access(struct cache_system *cache_system, struct trace_reader *reader,
+                        unsigned num_workers);
+
+#endif
@@ -14,46 +14,378 @@
 
 #include "replacement_policies.h"
 
-// For LRU
+#include <string.h>
+
+#include "access_kernel.h"
+#include "next_use.h"
+
+// For checkpoints
+//
+// The state of a policy is saved as its arrays, one after the other, and
+// restored by copying them back in the same order.
+struct policy_array {
+    void *data;
+    size_t size;
+};
+
+static int policy_arrays_serialize(const struct policy_array *arrays, size_t count, FILE *out)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (fwrite(arrays[i].data, 1, arrays[i].size, out) != arrays[i].size) return 1;
+    }
+    return 0;
+}
+
+static int policy_arrays_restore(const struct policy_array *arrays, size_t count,
+                                 const uint8_t *data, size_t size)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) total += arrays[i].size;
+    if (total != size) return 1;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(arrays[i].data, data, arrays[i].size);
+        data += arrays[i].size;
+    }
+    return 0;
+}
+
+// For LRU and LRU_PREFER_CLEAN
+//
+// Every line has a rank within its set: 0 is the least recently used line and
+// associativity - 1 the most recently used one. The ranks of all sets live in
+// one contiguous block (set after set), stored in the narrowest unsigned type
+// that can hold associativity - 1.
 struct lru_data {
-    uint32_t **ages; // 2D array for tracking age: [set][age]
+    void *ranks;
+    uint32_t rank_bytes; // 1, 2, or 4
     uint32_t sets;
     uint32_t associativity;
 };
 
-// LRU Replacement Policy
-// ============================================================================
-// TODO feel free to create additional structs/enums as necessary
+static struct lru_data *lru_data_new(uint32_t sets, uint32_t associativity)
+{
+    struct lru_data *lru = calloc(1, sizeof(struct lru_data));
+    lru->sets = sets;
+    lru->associativity = associativity;
+    lru->rank_bytes = associativity <= (1u << 8) ? 1 : associativity <= (1u << 16) ? 2 : 4;
 
-void lru_cache_access(struct replacement_policy *replacement_policy,
-                      struct cache_system *cache_system, uint32_t set_idx, uint32_t tag)
+    // Initially, every rank is 0. The first touch of a line moves the lines
+    // touched before it (whose ranks are above 0) down one rank and leaves the
+    // untouched ones at 0, so every line of a set has a unique rank by the time
+    // all of them are valid and one must be evicted. The ranks of the sets that
+    // are never accessed are therefore never written.
+    lru->ranks = calloc((size_t)sets * associativity, lru->rank_bytes);
+    return lru;
+}
+
+static size_t lru_arrays(struct replacement_policy *replacement_policy,
+                         struct policy_array *arrays)
 {
-    // NOTE update the LRU replacement policy state given a new memory access
     struct lru_data *lru = (struct lru_data *)replacement_policy->data;
+    arrays[0] = (struct policy_array){lru->ranks,
+                                      (size_t)lru->sets * lru->associativity * lru->rank_bytes};
+    return 1;
+}
 
-    // Find the cache line with the tag
-    int start_index = set_idx * cache_system->associativity;
-    int accessed_index = -1;
-    for (uint32_t i = 0; i < lru->associativity; i++) {
-        struct cache_line *line = &cache_system->cache_lines[start_index + i];
-        if (line->status != INVALID && line->tag == tag) {
-            accessed_index = i;
-            break;
-        }
+int lru_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_serialize(arrays, lru_arrays(replacement_policy, arrays), out);
+}
+
+int lru_restore(struct replacement_policy *replacement_policy, const uint8_t *data, size_t size)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_restore(arrays, lru_arrays(replacement_policy, arrays), data, size);
+}
+
+static inline uint32_t lru_rank(const struct lru_data *lru, uint32_t set_idx, uint32_t way)
+{
+    size_t i = (size_t)set_idx * lru->associativity + way;
+    switch (lru->rank_bytes) {
+    case 1: return ((const uint8_t *)lru->ranks)[i];
+    case 2: return ((const uint16_t *)lru->ranks)[i];
+    default: return ((const uint32_t *)lru->ranks)[i];
     }
-    
-    if (accessed_index == -1) { // Miss
+}
+
+// Make way the most recently used line of its set: every line that was more
+// recently used than it moves down one rank. The loop is branch-free so that
+// the compiler can vectorize it.
+#define LRU_TOUCH(type)                                                                           \
+    do {                                                                                          \
+        type *r = (type *)lru->ranks + (size_t)set_idx * lru->associativity;                      \
+        type current = r[way];                                                                    \
+        for (uint32_t i = 0; i < lru->associativity; i++) {                                       \
+            r[i] -= r[i] > current;                                                               \
+        }                                                                                         \
+        r[way] = lru->associativity - 1;                                                          \
+    } while (0)
+
+static void lru_touch(struct lru_data *lru, uint32_t set_idx, uint32_t way)
+{
+    switch (lru->rank_bytes) {
+    case 1: LRU_TOUCH(uint8_t); break;
+    case 2: LRU_TOUCH(uint16_t); break;
+    default: LRU_TOUCH(uint32_t); break;
+    }
+}
+
+// For LRU and LRU_PREFER_CLEAN at high associativity
+//
+// Instead of ranks, every set keeps its lines on intrusive doubly-linked
+// recency lists (most recently used at the head), so that a touch and an
+// eviction are O(1). LRU uses a single list per set. LRU_PREFER_CLEAN keeps
+// clean and dirty lines on separate lists, so the least recently used clean
+// line is simply the tail of the clean list.
+//
+// A line's state normally only changes when it is accessed, and every access
+// touches the line, so the list a line was put on at its last touch is the
+// list for its current state. The exception is a dirty line that another core
+// cleans (see the clean hook); it is moved to its place in the clean list by
+// the time of its last touch, which the split lists keep per line.
+enum lru_list_kind { LRU_LIST_CLEAN, LRU_LIST_DIRTY, LRU_LIST_COUNT };
+
+#define LRU_LIST_NONE UINT32_MAX
+
+struct lru_list_data {
+    uint32_t *prev, *next; // Per line: neighbouring ways, or LRU_LIST_NONE.
+    uint8_t *kind;         // Per line: the list the line is on.
+    uint32_t *heads;       // Per set and list: the most recently used way.
+    uint32_t *tails;       // Per set and list: the least recently used way.
+    uint32_t *stamps;      // Per line: the set's clock at its last touch (split only).
+    uint32_t *clocks;      // Per set: the number of touches (split only).
+    uint32_t sets;
+    uint32_t associativity;
+    bool split_dirty; // Whether dirty lines go on their own list.
+};
+
+static struct lru_list_data *lru_list_data_new(uint32_t sets, uint32_t associativity,
+                                               bool split_dirty)
+{
+    struct lru_list_data *lists = calloc(1, sizeof(struct lru_list_data));
+    lists->sets = sets;
+    lists->associativity = associativity;
+    lists->split_dirty = split_dirty;
+
+    // See lru_list_prepare.
+    size_t num_lines = (size_t)sets * associativity;
+    size_t num_lists = (size_t)sets * LRU_LIST_COUNT;
+    lists->prev = calloc(num_lines, sizeof(uint32_t));
+    lists->next = calloc(num_lines, sizeof(uint32_t));
+    lists->kind = calloc(num_lines, sizeof(uint8_t));
+    lists->heads = calloc(num_lists, sizeof(uint32_t));
+    lists->tails = calloc(num_lists, sizeof(uint32_t));
+    if (split_dirty) {
+        lists->stamps = calloc(num_lines, sizeof(uint32_t));
+        lists->clocks = calloc(sets, sizeof(uint32_t));
+    }
+    return lists;
+}
+
+// The arrays start out zeroed, and a set's lists are only set up when the set
+// is first accessed, so the sets that are never accessed are never written. A
+// set that was not set up has way 0 at the head of both lists, which no other
+// set has: both heads are LRU_LIST_NONE until the first line is pushed, and a
+// line is only ever on one list.
+static void lru_list_prepare(struct lru_list_data *lists, uint32_t set_idx)
+{
+    size_t list = (size_t)set_idx * LRU_LIST_COUNT;
+    if (lists->heads[list + LRU_LIST_CLEAN] != 0 || lists->heads[list + LRU_LIST_DIRTY] != 0) {
         return;
     }
 
-    // Update the ages
-    uint32_t current_age = lru->ages[set_idx][accessed_index];
-    for (uint32_t i = 0; i < lru->associativity; i++) {
-        if (lru->ages[set_idx][i] > current_age) {
-            lru->ages[set_idx][i]--;
+    size_t set_start = (size_t)set_idx * lists->associativity;
+    memset(&lists->prev[set_start], 0xff, lists->associativity * sizeof(uint32_t));
+    memset(&lists->next[set_start], 0xff, lists->associativity * sizeof(uint32_t));
+    memset(&lists->kind[set_start], LRU_LIST_COUNT, lists->associativity * sizeof(uint8_t));
+    memset(&lists->heads[list], 0xff, LRU_LIST_COUNT * sizeof(uint32_t));
+    memset(&lists->tails[list], 0xff, LRU_LIST_COUNT * sizeof(uint32_t));
+}
+
+static void lru_list_unlink(struct lru_list_data *lists, uint32_t set_idx, uint32_t way)
+{
+    size_t line = (size_t)set_idx * lists->associativity + way;
+    if (lists->kind[line] == LRU_LIST_COUNT) return;
+
+    size_t list = (size_t)set_idx * LRU_LIST_COUNT + lists->kind[line];
+    uint32_t *set_prev = &lists->prev[(size_t)set_idx * lists->associativity];
+    uint32_t *set_next = &lists->next[(size_t)set_idx * lists->associativity];
+    uint32_t prev = set_prev[way], next = set_next[way];
+    if (prev != LRU_LIST_NONE) {
+        set_next[prev] = next;
+    } else {
+        lists->heads[list] = next;
+    }
+    if (next != LRU_LIST_NONE) {
+        set_prev[next] = prev;
+    } else {
+        lists->tails[list] = prev;
+    }
+}
+
+static void lru_list_push_head(struct lru_list_data *lists, uint32_t set_idx, uint32_t way,
+                               enum lru_list_kind kind)
+{
+    size_t line = (size_t)set_idx * lists->associativity + way;
+    size_t list = (size_t)set_idx * LRU_LIST_COUNT + kind;
+    uint32_t *set_prev = &lists->prev[(size_t)set_idx * lists->associativity];
+    uint32_t *set_next = &lists->next[(size_t)set_idx * lists->associativity];
+    uint32_t head = lists->heads[list];
+
+    set_prev[way] = LRU_LIST_NONE;
+    set_next[way] = head;
+    if (head != LRU_LIST_NONE) {
+        set_prev[head] = way;
+    } else {
+        lists->tails[list] = way;
+    }
+    lists->heads[list] = way;
+    lists->kind[line] = kind;
+}
+
+void lru_list_cache_access(struct replacement_policy *replacement_policy,
+                           struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
+{
+    struct lru_list_data *lists = (struct lru_list_data *)replacement_policy->data;
+
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return;
+
+    enum lru_list_kind kind = LRU_LIST_CLEAN;
+    if (lists->split_dirty &&
+        cache_system_set_states(cache_system, set_idx)[way] == MODIFIED) {
+        kind = LRU_LIST_DIRTY;
+    }
+    lru_list_prepare(lists, set_idx);
+    lru_list_unlink(lists, set_idx, way);
+    lru_list_push_head(lists, set_idx, way, kind);
+    if (lists->split_dirty) {
+        lists->stamps[(size_t)set_idx * lists->associativity + way] = ++lists->clocks[set_idx];
+    }
+}
+
+void lru_list_clean(struct replacement_policy *replacement_policy,
+                    struct cache_system *cache_system, uint32_t set_idx, uint32_t way)
+{
+    struct lru_list_data *lists = (struct lru_list_data *)replacement_policy->data;
+    size_t set_start = (size_t)set_idx * lists->associativity;
+    if (!lists->split_dirty || lists->kind[set_start + way] != LRU_LIST_DIRTY) return;
+    lru_list_unlink(lists, set_idx, way);
+
+    // Find the first line of the clean list (from the most recently used one)
+    // that was touched before this one, and insert the line in front of it.
+    size_t list = (size_t)set_idx * LRU_LIST_COUNT + LRU_LIST_CLEAN;
+    const uint32_t *stamps = &lists->stamps[set_start];
+    uint32_t *set_prev = &lists->prev[set_start];
+    uint32_t *set_next = &lists->next[set_start];
+    uint32_t next = lists->heads[list];
+    while (next != LRU_LIST_NONE && stamps[next] > stamps[way]) next = set_next[next];
+    if (next == LRU_LIST_NONE) {
+        // Every clean line is more recent: append the line at the tail.
+        uint32_t tail = lists->tails[list];
+        set_prev[way] = tail;
+        set_next[way] = LRU_LIST_NONE;
+        if (tail != LRU_LIST_NONE) {
+            set_next[tail] = way;
+        } else {
+            lists->heads[list] = way;
         }
+        lists->tails[list] = way;
+    } else if (set_prev[next] == LRU_LIST_NONE) {
+        lru_list_push_head(lists, set_idx, way, LRU_LIST_CLEAN);
+    } else {
+        uint32_t prev = set_prev[next];
+        set_prev[way] = prev;
+        set_next[way] = next;
+        set_next[prev] = way;
+        set_prev[next] = way;
+    }
+    lists->kind[set_start + way] = LRU_LIST_CLEAN;
+}
+
+uint32_t lru_list_eviction_index(struct replacement_policy *replacement_policy,
+                                 struct cache_system *cache_system, uint32_t set_idx)
+{
+    // Evict the least recently used clean line if there is one. Without
+    // split_dirty, every line is on the clean list.
+    struct lru_list_data *lists = (struct lru_list_data *)replacement_policy->data;
+    const uint32_t *tails = &lists->tails[(size_t)set_idx * LRU_LIST_COUNT];
+    return tails[LRU_LIST_CLEAN] != LRU_LIST_NONE ? tails[LRU_LIST_CLEAN]
+                                                   : tails[LRU_LIST_DIRTY];
+}
+
+void lru_list_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
+{
+    struct lru_list_data *lists = (struct lru_list_data *)replacement_policy->data;
+    free(lists->prev);
+    free(lists->next);
+    free(lists->kind);
+    free(lists->heads);
+    free(lists->tails);
+    free(lists->stamps);
+    free(lists->clocks);
+    free(lists);
+}
+
+static size_t lru_list_arrays(struct replacement_policy *replacement_policy,
+                              struct policy_array *arrays)
+{
+    struct lru_list_data *lists = (struct lru_list_data *)replacement_policy->data;
+    size_t num_lines = (size_t)lists->sets * lists->associativity;
+    size_t num_lists = (size_t)lists->sets * LRU_LIST_COUNT;
+    arrays[0] = (struct policy_array){lists->prev, num_lines * sizeof(uint32_t)};
+    arrays[1] = (struct policy_array){lists->next, num_lines * sizeof(uint32_t)};
+    arrays[2] = (struct policy_array){lists->kind, num_lines * sizeof(uint8_t)};
+    arrays[3] = (struct policy_array){lists->heads, num_lists * sizeof(uint32_t)};
+    arrays[4] = (struct policy_array){lists->tails, num_lists * sizeof(uint32_t)};
+    if (!lists->split_dirty) return 5;
+    arrays[5] = (struct policy_array){lists->stamps, num_lines * sizeof(uint32_t)};
+    arrays[6] = (struct policy_array){lists->clocks, lists->sets * sizeof(uint32_t)};
+    return 7;
+}
+
+int lru_list_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[7];
+    return policy_arrays_serialize(arrays, lru_list_arrays(replacement_policy, arrays), out);
+}
+
+int lru_list_restore(struct replacement_policy *replacement_policy, const uint8_t *data,
+                     size_t size)
+{
+    struct policy_array arrays[7];
+    return policy_arrays_restore(arrays, lru_list_arrays(replacement_policy, arrays), data, size);
+}
+
+static struct replacement_policy *lru_list_replacement_policy_new(uint32_t sets,
+                                                                  uint32_t associativity,
+                                                                  bool split_dirty)
+{
+    struct replacement_policy *lru_list_rp = calloc(1, sizeof(struct replacement_policy));
+    lru_list_rp->cache_access = &lru_list_cache_access;
+    lru_list_rp->eviction_index = &lru_list_eviction_index;
+    lru_list_rp->cleanup = &lru_list_replacement_policy_cleanup;
+    lru_list_rp->clean = &lru_list_clean;
+    lru_list_rp->serialize = &lru_list_serialize;
+    lru_list_rp->restore = &lru_list_restore;
+    lru_list_rp->data = lru_list_data_new(sets, associativity, split_dirty);
+    return lru_list_rp;
+}
+
+// LRU Replacement Policy
+// ============================================================================
+void lru_cache_access(struct replacement_policy *replacement_policy,
+                      struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
+{
+    // NOTE update the LRU replacement policy state given a new memory access
+    struct lru_data *lru = (struct lru_data *)replacement_policy->data;
+
+    // Find the cache line with the tag
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way >= 0) {
+        lru_touch(lru, set_idx, way);
     }
-    lru->ages[set_idx][accessed_index] = lru->associativity - 1;
 }
 
 uint32_t lru_eviction_index(struct replacement_policy *replacement_policy,
@@ -61,10 +393,10 @@ uint32_t lru_eviction_index(struct replacement_policy *replacement_policy,
 {
     // NOTE return the index within the set that should be evicted.
     struct lru_data *lru = (struct lru_data *)replacement_policy->data;
-    
-    // Search for the oldest age (0) in the set
+
+    // Search for the oldest rank (0) in the set
     for (uint32_t i = 0; i < lru->associativity; i++) {
-        if (lru->ages[set_idx][i] == 0) {
+        if (lru_rank(lru, set_idx, i) == 0) {
             return i;
         }
     }
@@ -72,48 +404,111 @@ uint32_t lru_eviction_index(struct replacement_policy *replacement_policy,
     exit(1);
 }
 
+// For the access kernels, whose associativities all have one-byte ranks.
+static inline void lru_byte_touch(struct lru_data *lru, uint32_t set_idx, uint32_t way,
+                                  uint32_t ways)
+{
+    uint8_t *r = (uint8_t *)lru->ranks + (size_t)set_idx * ways;
+    uint8_t current = r[way];
+    for (uint32_t i = 0; i < ways; i++) {
+        r[i] -= r[i] > current;
+    }
+    r[way] = ways - 1;
+}
+
+static inline uint32_t lru_byte_victim(struct lru_data *lru, uint32_t set_idx,
+                                       const uint8_t *set_states, uint32_t ways)
+{
+    const uint8_t *r = (const uint8_t *)lru->ranks + (size_t)set_idx * ways;
+    uint32_t way = 0;
+    for (uint32_t i = 0; i < ways; i++) {
+        if (r[i] == 0) {
+            way = i;
+            break;
+        }
+    }
+    return way;
+}
+
+ACCESS_KERNELS(lru_byte, struct lru_data)
+
 void lru_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
 {
     // NOTE cleanup any additional memory that you allocated in the
     // lru_replacement_policy_new function.
     struct lru_data *lru = (struct lru_data *)replacement_policy->data;
-    for (uint32_t i = 0; i < lru->sets; i++) {
-        free(lru->ages[i]);
-    }
-    free(lru->ages);
+    free(lru->ranks);
     free(lru);
 }
 
 struct replacement_policy *lru_replacement_policy_new(uint32_t sets, uint32_t associativity)
 {
+    if (associativity >= cache_system_high_associativity()) {
+        return lru_list_replacement_policy_new(sets, associativity, false);
+    }
+
     struct replacement_policy *lru_rp = calloc(1, sizeof(struct replacement_policy));
     lru_rp->cache_access = &lru_cache_access;
     lru_rp->eviction_index = &lru_eviction_index;
     lru_rp->cleanup = &lru_replacement_policy_cleanup;
+    lru_rp->serialize = &lru_serialize;
+    lru_rp->restore = &lru_restore;
 
     // NOTE allocate any additional memory to store metadata here and assign to
     // lru_rp->data.
-    struct lru_data *lru = calloc(1, sizeof(struct lru_data));
-    lru->sets = sets;
-    lru->associativity = associativity;
-    // Allocate the ages 2D array
-    lru->ages = calloc(sets, sizeof(uint32_t *));
-    for (int i = 0; i < sets; i++) {
-        lru->ages[i] = calloc(associativity, sizeof(uint32_t));
-        // Initialize the ages - initially all lines are 0, 1, 2, ..., associativity-1
-        // This ensures all lines in a set have unique ages
-        for (int j = 0; j < associativity; j++) {
-            lru->ages[i][j] = j;
-        }
-    }
-    lru_rp->data = lru;
+    lru_rp->data = lru_data_new(sets, associativity);
+    lru_rp->access_batch = access_kernel_select(lru_byte_kernels, associativity);
     return lru_rp;
 }
 
 // RAND Replacement Policy
 // ============================================================================
+// Every set draws from its own PCG32 generator (state only, with a fixed
+// increment), so the victims of a set do not depend on how accesses to other
+// sets interleave with it: runs are reproducible for a given seed, and the
+// set-partitioned parallel simulation gets the same results without sharing
+// any state between threads.
+//
+// A set's generator is seeded with splitmix64 of the seed and the set index
+// when it draws its first victim, like the lazily initialized LRU ranks: a
+// state of 0 means the set has not been seeded yet, so the states of all sets
+// start out as zeroed memory. (A generator that steps onto the state 0 is
+// seeded again, which is as deterministic, and happens once in 2^64 draws.)
+struct rand_data {
+    uint64_t *state; // One generator per set, or 0 if it was not seeded yet.
+    uint64_t seed;
+    uint32_t sets;
+};
+
+static inline uint64_t splitmix64(uint64_t x)
+{
+    x += UINT64_C(0x9e3779b97f4a7c15);
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+static inline uint32_t pcg32_next(uint64_t *state)
+{
+    uint64_t old = *state;
+    *state = old * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << (-rot & 31));
+}
+
+// Draw a way of the set from its generator, seeding it first if needed.
+static inline uint32_t rand_draw(struct rand_data *rng, uint32_t set_idx, uint32_t ways)
+{
+    uint64_t *state = &rng->state[set_idx];
+    if (*state == 0) {
+        *state = splitmix64(rng->seed + (uint64_t)set_idx * UINT64_C(0x9e3779b97f4a7c15));
+    }
+    return ((uint64_t)pcg32_next(state) * ways) >> 32;
+}
+
 void rand_cache_access(struct replacement_policy *replacement_policy,
-                       struct cache_system *cache_system, uint32_t set_idx, uint32_t tag)
+                       struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
 {
     // NOTE: update the RAND replacement policy state given a new memory access
     // Do not need to do anything for RAND policy
@@ -124,142 +519,653 @@ uint32_t rand_eviction_index(struct replacement_policy *replacement_policy,
                              struct cache_system *cache_system, uint32_t set_idx)
 {
     // NOTE: return the index within the set that should be evicted.
-    // This should be a random index within the set.
-    return rand() % cache_system->associativity;
+    // This should be a random index within the set (scaled by a multiply
+    // rather than a modulo).
+    struct rand_data *rng = (struct rand_data *)replacement_policy->data;
+    return rand_draw(rng, set_idx, cache_system->associativity);
+}
+
+static inline void rand_touch(struct rand_data *rng, uint32_t set_idx, uint32_t way,
+                              uint32_t ways)
+{
+}
+
+static inline uint32_t rand_victim(struct rand_data *rng, uint32_t set_idx,
+                                   const uint8_t *set_states, uint32_t ways)
+{
+    return rand_draw(rng, set_idx, ways);
 }
 
+ACCESS_KERNELS(rand, struct rand_data)
+
 void rand_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
 {
-    // NOTE: cleanup any additional memory that you allocated in the
-    // rand_replacement_policy_new function.
-    // No additional memory was allocated in rand_replacement_policy_new,
-    // so there is nothing to clean up here.
-    return;
+    struct rand_data *rng = (struct rand_data *)replacement_policy->data;
+    free(rng->state);
+    free(rng);
+}
+
+static size_t rand_arrays(struct replacement_policy *replacement_policy,
+                          struct policy_array *arrays)
+{
+    struct rand_data *rng = (struct rand_data *)replacement_policy->data;
+    arrays[0] = (struct policy_array){rng->state, (size_t)rng->sets * sizeof(uint64_t)};
+    return 1;
+}
+
+int rand_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_serialize(arrays, rand_arrays(replacement_policy, arrays), out);
 }
 
-struct replacement_policy *rand_replacement_policy_new(uint32_t sets, uint32_t associativity)
+int rand_restore(struct replacement_policy *replacement_policy, const uint8_t *data, size_t size)
 {
-    // Seed randomness
-    srand(time(NULL));
+    struct policy_array arrays[1];
+    return policy_arrays_restore(arrays, rand_arrays(replacement_policy, arrays), data, size);
+}
 
-    struct replacement_policy *rand_rp = malloc(sizeof(struct replacement_policy));
+struct replacement_policy *rand_replacement_policy_new(uint32_t sets, uint32_t associativity,
+                                                       uint64_t seed)
+{
+    struct replacement_policy *rand_rp = calloc(1, sizeof(struct replacement_policy));
     rand_rp->cache_access = &rand_cache_access;
     rand_rp->eviction_index = &rand_eviction_index;
+    rand_rp->serialize = &rand_serialize;
+    rand_rp->restore = &rand_restore;
     rand_rp->cleanup = &rand_replacement_policy_cleanup;
 
-    // NOTE: allocate any additional memory to store metadata here and assign to
-    // rand_rp->data.
-    // No addition memory is needed for the RAND policy.
-    rand_rp->data = NULL;
+    // The sets are seeded as they draw their first victims.
+    struct rand_data *rng = calloc(1, sizeof(struct rand_data));
+    rng->seed = seed;
+    rng->sets = sets;
+    rng->state = calloc(sets, sizeof(uint64_t));
+    rand_rp->data = rng;
+    rand_rp->access_batch = access_kernel_select(rand_kernels, associativity);
     return rand_rp;
 }
 
 // LRU_PREFER_CLEAN Replacement Policy
 // ============================================================================
-void lru_prefer_clean_cache_access(struct replacement_policy *replacement_policy,
-                                   struct cache_system *cache_system, uint32_t set_idx,
-                                   uint32_t tag)
+// LRU_PREFER_CLEAN shares the recency state (and therefore cache_access and
+// cleanup) with LRU; only the choice of the line to evict differs.
+uint32_t lru_prefer_clean_eviction_index(struct replacement_policy *replacement_policy,
+                                         struct cache_system *cache_system, uint32_t set_idx)
 {
-    // NOTE update the LRU_PREFER_CLEAN replacement policy state given a new
-    // memory access
-    // NOTE: you may be able to share code with the LRU policy
-    struct lru_data *lru = (struct lru_data *)replacement_policy->data;
-    
-    // Find the cache line with the tag
-    int start_idx = set_idx * cache_system->associativity;
-    int access_index = -1;
-    for (uint32_t i = 0; i < lru->associativity; i++) {
-        struct cache_line *line = &cache_system->cache_lines[start_idx + i];
-        if (line->status != INVALID && line->tag == tag) {
-            access_index = i;
-            break;
+    // NOTE return the index within the set that should be evicted.
+    struct lru_data *lru_pc = (struct lru_data *)replacement_policy->data;
+    const uint8_t *states = cache_system_set_states(cache_system, set_idx);
+
+    // First, try to find the least recently used clean line. Otherwise, evict
+    // the least recently used (dirty) line, which has rank 0.
+    uint32_t oldest_clean_index = UINT32_MAX;
+    uint32_t oldest_clean_rank = UINT32_MAX;
+    uint32_t oldest_index = 0;
+    for (uint32_t i = 0; i < cache_system->associativity; i++) {
+        uint32_t rank = lru_rank(lru_pc, set_idx, i);
+        bool clean = states[i] == EXCLUSIVE || states[i] == SHARED;
+        if (clean && rank < oldest_clean_rank) {
+            oldest_clean_rank = rank;
+            oldest_clean_index = i;
         }
-    }
-    
-    if (access_index == -1) { // Miss
-        return;
-    }
-    
-    // Update the age
-    uint32_t current_age = lru->ages[set_idx][access_index];
-    for (uint32_t i = 0; i < lru->associativity; i++) {
-        if (lru->ages[set_idx][i] > current_age) {
-            lru->ages[set_idx][i]--;
+        if (rank == 0) {
+            oldest_index = i;
         }
     }
-    lru->ages[set_idx][access_index] = lru->associativity - 1;
+    return oldest_clean_index != UINT32_MAX ? oldest_clean_index : oldest_index;
 }
 
-uint32_t lru_prefer_clean_eviction_index(struct replacement_policy *replacement_policy,
-                                         struct cache_system *cache_system, uint32_t set_idx)
+static inline void lru_prefer_clean_byte_touch(struct lru_data *lru, uint32_t set_idx,
+                                               uint32_t way, uint32_t ways)
 {
-    // NOTE return the index within the set that should be evicted.
-    struct lru_data *lru_pc = (struct lru_data *)replacement_policy->data;
-    int set_start = set_idx * cache_system->associativity;
-    // First, try to find the least recently used clean line
+    lru_byte_touch(lru, set_idx, way, ways);
+}
+
+static inline uint32_t lru_prefer_clean_byte_victim(struct lru_data *lru, uint32_t set_idx,
+                                                    const uint8_t *set_states, uint32_t ways)
+{
+    const uint8_t *r = (const uint8_t *)lru->ranks + (size_t)set_idx * ways;
     uint32_t oldest_clean_index = UINT32_MAX;
-    uint32_t oldest_clean_age = UINT32_MAX;
-    for (int i = 0; i < cache_system->associativity; i++) {
-        struct cache_line *line = &cache_system->cache_lines[set_start + i];
-        if (line->status == EXCLUSIVE) {  // Clean line
-            if (lru_pc->ages[set_idx][i] < oldest_clean_age) {
-                oldest_clean_age = lru_pc->ages[set_idx][i];
-                oldest_clean_index = i;
-            }
+    uint32_t oldest_clean_rank = UINT32_MAX;
+    uint32_t oldest_index = 0;
+    for (uint32_t i = 0; i < ways; i++) {
+        bool clean = set_states[i] == EXCLUSIVE || set_states[i] == SHARED;
+        if (clean && r[i] < oldest_clean_rank) {
+            oldest_clean_rank = r[i];
+            oldest_clean_index = i;
+        }
+        if (r[i] == 0) {
+            oldest_index = i;
         }
     }
+    return oldest_clean_index != UINT32_MAX ? oldest_clean_index : oldest_index;
+}
 
-    if (oldest_clean_index != UINT32_MAX) {
-        return oldest_clean_index;
+ACCESS_KERNELS(lru_prefer_clean_byte, struct lru_data)
+
+struct replacement_policy *lru_prefer_clean_replacement_policy_new(uint32_t sets,
+                                                                   uint32_t associativity)
+{
+    if (associativity >= cache_system_high_associativity()) {
+        return lru_list_replacement_policy_new(sets, associativity, true);
     }
 
-    // Otherwise, find the least recently used dirty line
-    uint32_t oldest_dirty_age = UINT32_MAX;
-    uint32_t oldest_dirty_index = 0;
-    for (int i = 0; i < cache_system->associativity; i++) {
-        if (lru_pc->ages[set_idx][i] < oldest_dirty_age) {
-            oldest_dirty_age = lru_pc->ages[set_idx][i];
-            oldest_dirty_index = i;
+    struct replacement_policy *lru_prefer_clean_rp = calloc(1, sizeof(struct replacement_policy));
+    lru_prefer_clean_rp->cache_access = &lru_cache_access;
+    lru_prefer_clean_rp->eviction_index = &lru_prefer_clean_eviction_index;
+    lru_prefer_clean_rp->cleanup = &lru_replacement_policy_cleanup;
+    lru_prefer_clean_rp->serialize = &lru_serialize;
+    lru_prefer_clean_rp->restore = &lru_restore;
+
+    // NOTE allocate any additional memory to store metadata here and assign to
+    // lru_prefer_clean_rp->data.
+    lru_prefer_clean_rp->data = lru_data_new(sets, associativity);
+    lru_prefer_clean_rp->access_batch =
+        access_kernel_select(lru_prefer_clean_byte_kernels, associativity);
+    return lru_prefer_clean_rp;
+}
+
+// PLRU Replacement Policy
+// ============================================================================
+// Tree pseudo-LRU: the ways of a set are the leaves of a binary tree whose
+// internal nodes each hold one bit pointing towards the less recently used
+// half. The nodes are numbered like a binary heap (the root is node 1 and the
+// children of node n are 2n and 2n + 1), and node n is stored as bit n - 1 of
+// the set's bits. Associativities that are not powers of two use the tree of
+// the next power of two, and the eviction walk never enters a subtree that
+// only has nonexistent ways.
+struct plru_data {
+    uint8_t *bits;       // tree_bytes per set, set after set.
+    uint32_t tree_bytes; // Bytes per set; every set starts on its own byte.
+    uint32_t leaves;     // The associativity rounded up to a power of two.
+    uint32_t sets;
+    uint32_t associativity;
+};
+
+static inline uint32_t plru_tree_bytes(uint32_t leaves)
+{
+    return leaves > 1 ? (leaves - 1 + 7) / 8 : 1;
+}
+
+// Walk from the leaf of way to the root, pointing every node away from it.
+static inline void plru_tree_touch(uint8_t *bits, uint32_t leaves, uint32_t way)
+{
+    for (uint32_t node = leaves + way; node > 1; node >>= 1) {
+        uint32_t parent = (node >> 1) - 1;
+        if (node & 1) {
+            bits[parent >> 3] &= ~(1u << (parent & 7));
+        } else {
+            bits[parent >> 3] |= 1u << (parent & 7);
         }
     }
-    return oldest_dirty_index;
 }
 
-void lru_prefer_clean_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
+// Follow the bits from the root. The node covers the ways [first, first +
+// size).
+static inline uint32_t plru_tree_victim(const uint8_t *bits, uint32_t leaves,
+                                        uint32_t associativity)
 {
-    // NOTE cleanup any additional memory that you allocated in the
-    // lru_prefer_clean_replacement_policy_new function.
-    struct lru_data *lru = (struct lru_data *)replacement_policy->data;
-    for (uint32_t i = 0; i < lru->sets; i++) {
-        free(lru->ages[i]);
+    uint32_t node = 1, first = 0;
+    for (uint32_t size = leaves; size > 1; size >>= 1) {
+        uint32_t bit = bits[(node - 1) >> 3] >> ((node - 1) & 7) & 1;
+        if (bit && first + size / 2 < associativity) {
+            node = 2 * node + 1;
+            first += size / 2;
+        } else {
+            node = 2 * node;
+        }
     }
-    free(lru->ages);
-    free(lru);
+    return first;
 }
 
-struct replacement_policy *lru_prefer_clean_replacement_policy_new(uint32_t sets,
-                                                                   uint32_t associativity)
+void plru_cache_access(struct replacement_policy *replacement_policy,
+                       struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
 {
-    struct replacement_policy *lru_prefer_clean_rp = malloc(sizeof(struct replacement_policy));
-    lru_prefer_clean_rp->cache_access = &lru_prefer_clean_cache_access;
-    lru_prefer_clean_rp->eviction_index = &lru_prefer_clean_eviction_index;
-    lru_prefer_clean_rp->cleanup = &lru_prefer_clean_replacement_policy_cleanup;
+    struct plru_data *plru = (struct plru_data *)replacement_policy->data;
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return;
+    plru_tree_touch(&plru->bits[(size_t)set_idx * plru->tree_bytes], plru->leaves, way);
+}
 
-    // NOTE allocate any additional memory to store metadata here and assign to
-    // lru_prefer_clean_rp->data.
-    struct lru_data *lru = calloc(1, sizeof(struct lru_data));
-    lru->sets = sets;
-    lru->associativity = associativity;
-    // Allocate the ages 2D array
-    lru->ages = calloc(sets, sizeof(uint32_t *));
-    for (uint32_t i = 0; i< sets; i++) {
-        lru->ages[i] = calloc(associativity, sizeof(uint32_t));
-        // Initialize the ages - initially all lines are 0, 1, 2, ..., associativity-1
-        for (uint32_t j = 0; j < associativity; j++) {
-            lru->ages[i][j] = j;
+uint32_t plru_eviction_index(struct replacement_policy *replacement_policy,
+                             struct cache_system *cache_system, uint32_t set_idx)
+{
+    struct plru_data *plru = (struct plru_data *)replacement_policy->data;
+    return plru_tree_victim(&plru->bits[(size_t)set_idx * plru->tree_bytes], plru->leaves,
+                            plru->associativity);
+}
+
+// The kernels' associativities are powers of two, so they are the leaves.
+static inline void plru_touch(struct plru_data *plru, uint32_t set_idx, uint32_t way,
+                              uint32_t ways)
+{
+    plru_tree_touch(&plru->bits[(size_t)set_idx * plru_tree_bytes(ways)], ways, way);
+}
+
+static inline uint32_t plru_victim(struct plru_data *plru, uint32_t set_idx,
+                                   const uint8_t *set_states, uint32_t ways)
+{
+    return plru_tree_victim(&plru->bits[(size_t)set_idx * plru_tree_bytes(ways)], ways, ways);
+}
+
+ACCESS_KERNELS(plru, struct plru_data)
+
+void plru_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
+{
+    struct plru_data *plru = (struct plru_data *)replacement_policy->data;
+    free(plru->bits);
+    free(plru);
+}
+
+static size_t plru_arrays(struct replacement_policy *replacement_policy,
+                          struct policy_array *arrays)
+{
+    struct plru_data *plru = (struct plru_data *)replacement_policy->data;
+    arrays[0] = (struct policy_array){plru->bits, (size_t)plru->sets * plru->tree_bytes};
+    return 1;
+}
+
+int plru_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_serialize(arrays, plru_arrays(replacement_policy, arrays), out);
+}
+
+int plru_restore(struct replacement_policy *replacement_policy, const uint8_t *data, size_t size)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_restore(arrays, plru_arrays(replacement_policy, arrays), data, size);
+}
+
+struct replacement_policy *plru_replacement_policy_new(uint32_t sets, uint32_t associativity)
+{
+    struct replacement_policy *plru_rp = calloc(1, sizeof(struct replacement_policy));
+    plru_rp->cache_access = &plru_cache_access;
+    plru_rp->eviction_index = &plru_eviction_index;
+    plru_rp->cleanup = &plru_replacement_policy_cleanup;
+    plru_rp->serialize = &plru_serialize;
+    plru_rp->restore = &plru_restore;
+
+    struct plru_data *plru = calloc(1, sizeof(struct plru_data));
+    plru->sets = sets;
+    plru->associativity = associativity;
+    plru->leaves = 1;
+    while (plru->leaves < associativity) plru->leaves *= 2;
+    plru->tree_bytes = plru_tree_bytes(plru->leaves);
+    plru->bits = calloc((size_t)sets * plru->tree_bytes, sizeof(uint8_t));
+    plru_rp->data = plru;
+    plru_rp->access_batch = access_kernel_select(plru_kernels, associativity);
+    return plru_rp;
+}
+
+// SRRIP and BRRIP Replacement Policies
+// ============================================================================
+// Re-reference interval prediction: every line has a 2-bit re-reference
+// prediction value (RRPV), where 0 means "reused soon" and RRIP_DISTANT means
+// "reused in the distant future". A hit sets the RRPV to 0. The victim is the
+// first line with a distant RRPV; if there is none, every RRPV in the set is
+// aged until there is. SRRIP inserts new lines with RRIP_LONG. BRRIP inserts
+// them with RRIP_DISTANT, except for one fill in every BRRIP_LONG_INTERVAL
+// (counted per set, so that the result does not depend on how the sets are
+// split between threads), which gets RRIP_LONG.
+//
+// The state of a set is one contiguous block in a single array: the RRPVs,
+// four per byte, then one "filled" bit per line, then the BRRIP fill counter.
+// The filled bit tells a fill from a hit in cache_access: it is set when a
+// line is filled and cleared when the line is chosen as a victim.
+#define RRIP_DISTANT 3
+#define RRIP_LONG 2
+#define BRRIP_LONG_INTERVAL 32
+
+struct rrip_data {
+    uint8_t *state;          // stride bytes per set, set after set.
+    uint32_t stride;         // See rrip_stride.
+    uint32_t rrpv_bytes;     // See rrip_rrpv_bytes.
+    uint32_t sets;
+    uint32_t associativity;
+    bool bimodal; // BRRIP rather than SRRIP.
+};
+
+static inline void rrip_set_rrpv(uint8_t *rrpvs, uint32_t way, uint32_t rrpv)
+{
+    uint32_t shift = 2 * (way & 3);
+    rrpvs[way >> 2] = (rrpvs[way >> 2] & ~(3u << shift)) | rrpv << shift;
+}
+
+// The layout of a set's state depends only on the associativity, so the
+// kernels compute it from their constant number of ways and the generic
+// functions pass rrip->associativity.
+static inline uint32_t rrip_rrpv_bytes(uint32_t ways)
+{
+    return (ways + 3) / 4;
+}
+
+static inline uint32_t rrip_filled_bytes(uint32_t ways)
+{
+    return (ways + 7) / 8;
+}
+
+static inline uint32_t rrip_stride(uint32_t ways)
+{
+    return rrip_rrpv_bytes(ways) + rrip_filled_bytes(ways) + 1;
+}
+
+static inline void rrip_touch(struct rrip_data *rrip, uint32_t set_idx, uint32_t way,
+                              uint32_t ways)
+{
+    uint8_t *rrpvs = &rrip->state[(size_t)set_idx * rrip_stride(ways)];
+    uint8_t *filled = rrpvs + rrip_rrpv_bytes(ways);
+    uint8_t *fill_count = filled + rrip_filled_bytes(ways);
+
+    if (filled[way >> 3] & (1u << (way & 7))) {
+        // Hit promotion.
+        rrip_set_rrpv(rrpvs, way, 0);
+        return;
+    }
+
+    filled[way >> 3] |= 1u << (way & 7);
+    uint32_t rrpv = RRIP_LONG;
+    if (rrip->bimodal) {
+        rrpv = *fill_count == 0 ? RRIP_LONG : RRIP_DISTANT;
+        *fill_count = (*fill_count + 1) % BRRIP_LONG_INTERVAL;
+    }
+    rrip_set_rrpv(rrpvs, way, rrpv);
+}
+
+static inline uint32_t rrip_victim(struct rrip_data *rrip, uint32_t set_idx,
+                                   const uint8_t *set_states, uint32_t ways)
+{
+    uint8_t *rrpvs = &rrip->state[(size_t)set_idx * rrip_stride(ways)];
+    uint32_t rrpv_bytes = rrip_rrpv_bytes(ways);
+    uint8_t *filled = rrpvs + rrpv_bytes;
+
+    // The fields of the last RRPV byte that are ways.
+    uint32_t last_rrpv_mask = ways % 4 ? (1u << 2 * (ways % 4)) - 1 : 0xff;
+
+    // Each pass looks at four RRPVs per byte at once. A field is distant when
+    // both of its bits are set; if no field is, every field is below
+    // RRIP_DISTANT and adding one to each of them cannot carry into the next.
+    for (;;) {
+        for (uint32_t i = 0; i < rrpv_bytes; i++) {
+            uint32_t mask = i + 1 == rrpv_bytes ? last_rrpv_mask : 0xff;
+            uint32_t distant = rrpvs[i] & (rrpvs[i] >> 1) & 0x55 & mask;
+            if (distant) {
+                uint32_t way = 4 * i + __builtin_ctz(distant) / 2;
+                filled[way >> 3] &= ~(1u << (way & 7));
+                return way;
+            }
+        }
+        for (uint32_t i = 0; i < rrpv_bytes; i++) {
+            uint32_t mask = i + 1 == rrpv_bytes ? last_rrpv_mask : 0xff;
+            rrpvs[i] += 0x55 & mask;
         }
     }
-    lru_prefer_clean_rp->data = lru;
+}
 
-    return lru_prefer_clean_rp;
+void rrip_cache_access(struct replacement_policy *replacement_policy,
+                       struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
+{
+    struct rrip_data *rrip = (struct rrip_data *)replacement_policy->data;
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return;
+    rrip_touch(rrip, set_idx, way, rrip->associativity);
+}
+
+uint32_t rrip_eviction_index(struct replacement_policy *replacement_policy,
+                             struct cache_system *cache_system, uint32_t set_idx)
+{
+    struct rrip_data *rrip = (struct rrip_data *)replacement_policy->data;
+    return rrip_victim(rrip, set_idx, NULL, rrip->associativity);
+}
+
+ACCESS_KERNELS(rrip, struct rrip_data)
+
+void rrip_invalidate(struct replacement_policy *replacement_policy,
+                     struct cache_system *cache_system, uint32_t set_idx, uint32_t way)
+{
+    // The next access to the way is a fill again.
+    struct rrip_data *rrip = (struct rrip_data *)replacement_policy->data;
+    uint8_t *filled = &rrip->state[(size_t)set_idx * rrip->stride + rrip->rrpv_bytes];
+    filled[way >> 3] &= ~(1u << (way & 7));
+}
+
+void rrip_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
+{
+    struct rrip_data *rrip = (struct rrip_data *)replacement_policy->data;
+    free(rrip->state);
+    free(rrip);
+}
+
+static size_t rrip_arrays(struct replacement_policy *replacement_policy,
+                          struct policy_array *arrays)
+{
+    struct rrip_data *rrip = (struct rrip_data *)replacement_policy->data;
+    arrays[0] = (struct policy_array){rrip->state, (size_t)rrip->sets * rrip->stride};
+    return 1;
+}
+
+int rrip_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_serialize(arrays, rrip_arrays(replacement_policy, arrays), out);
+}
+
+int rrip_restore(struct replacement_policy *replacement_policy, const uint8_t *data, size_t size)
+{
+    struct policy_array arrays[1];
+    return policy_arrays_restore(arrays, rrip_arrays(replacement_policy, arrays), data, size);
+}
+
+static struct replacement_policy *rrip_replacement_policy_new(uint32_t sets,
+                                                              uint32_t associativity, bool bimodal)
+{
+    struct replacement_policy *rrip_rp = calloc(1, sizeof(struct replacement_policy));
+    rrip_rp->cache_access = &rrip_cache_access;
+    rrip_rp->eviction_index = &rrip_eviction_index;
+    rrip_rp->invalidate = &rrip_invalidate;
+    rrip_rp->cleanup = &rrip_replacement_policy_cleanup;
+    rrip_rp->serialize = &rrip_serialize;
+    rrip_rp->restore = &rrip_restore;
+
+    struct rrip_data *rrip = calloc(1, sizeof(struct rrip_data));
+    rrip->sets = sets;
+    rrip->associativity = associativity;
+    rrip->bimodal = bimodal;
+    rrip->rrpv_bytes = rrip_rrpv_bytes(associativity);
+    rrip->stride = rrip_stride(associativity);
+    rrip->state = calloc((size_t)sets * rrip->stride, sizeof(uint8_t));
+    rrip_rp->data = rrip;
+    rrip_rp->access_batch = access_kernel_select(rrip_kernels, associativity);
+    return rrip_rp;
+}
+
+struct replacement_policy *srrip_replacement_policy_new(uint32_t sets, uint32_t associativity)
+{
+    return rrip_replacement_policy_new(sets, associativity, false);
+}
+
+struct replacement_policy *brrip_replacement_policy_new(uint32_t sets, uint32_t associativity)
+{
+    return rrip_replacement_policy_new(sets, associativity, true);
+}
+
+// OPT Replacement Policy
+// ============================================================================
+// Belady's MIN: evict the line whose next use is furthest in the future (a
+// line that is never used again is furthest of all), which minimizes the
+// misses of a cache that fills every missing line. The next uses come from
+// the next-use index of the trace, and the policy counts the accesses to know
+// where in the trace it is.
+//
+// Every set keeps its ways in a binary max-heap ordered by the next use of
+// their lines, so the victim is the root and an access re-keys one way in
+// O(log associativity). The entries of the heaps and slots are stored XORed
+// with their own index in the set, so that zeroed memory is the identity
+// permutation: while all keys of a set are 0, that is a valid heap, and the
+// sets are only written once the trace touches them.
+struct opt_data {
+    const struct next_use *next_use;
+    uint64_t trace_count; // The length of the trace, to check checkpoints.
+    uint64_t position;    // The number of accesses so far.
+    uint64_t *keys;    // Per line: the position of its next use.
+    uint32_t *heaps;   // Per set: its ways, as a max-heap on their keys (^ index).
+    uint32_t *slots;   // Per line: the index of its way in the set's heap (^ way).
+    uint32_t sets;
+    uint32_t associativity;
+};
+
+// Move way to its place in its set's heap after its key changed.
+static void opt_sift(struct opt_data *opt, uint32_t set_idx, uint32_t way)
+{
+    size_t set_start = (size_t)set_idx * opt->associativity;
+    uint32_t *heap = &opt->heaps[set_start];
+    uint32_t *slots = &opt->slots[set_start];
+    const uint64_t *keys = &opt->keys[set_start];
+    uint64_t key = keys[way];
+    uint32_t i = slots[way] ^ way;
+
+    // Up, past the ways that are used sooner...
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        uint32_t up = heap[parent] ^ parent;
+        if (keys[up] >= key) break;
+        heap[i] = up ^ i;
+        slots[up] = i ^ up;
+        i = parent;
+    }
+    // ...or down, past the ways that are used later.
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= opt->associativity) break;
+        uint32_t down = heap[child] ^ child;
+        if (child + 1 < opt->associativity) {
+            uint32_t right = heap[child + 1] ^ (child + 1);
+            if (keys[right] > keys[down]) {
+                child++;
+                down = right;
+            }
+        }
+        if (keys[down] <= key) break;
+        heap[i] = down ^ i;
+        slots[down] = i ^ down;
+        i = child;
+    }
+    heap[i] = way ^ i;
+    slots[way] = i ^ way;
+}
+
+void opt_cache_access(struct replacement_policy *replacement_policy,
+                      struct cache_system *cache_system, uint32_t set_idx, uint64_t tag)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    uint64_t next = opt->position < opt->next_use->count
+                        ? opt->next_use->positions[opt->position]
+                        : NEXT_USE_NEVER;
+    opt->position++;
+
+    int way = cache_system_find_way(cache_system, set_idx, tag);
+    if (way < 0) return;
+    opt->keys[(size_t)set_idx * opt->associativity + way] = next;
+    opt_sift(opt, set_idx, way);
+}
+
+// Only the last access of the run decides the next use of the line.
+void opt_repeat(struct replacement_policy *replacement_policy, struct cache_system *cache_system,
+                uint32_t set_idx, uint64_t tag, uint64_t count)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    opt->position += count - 1;
+    opt_cache_access(replacement_policy, cache_system, set_idx, tag);
+}
+
+uint32_t opt_eviction_index(struct replacement_policy *replacement_policy,
+                            struct cache_system *cache_system, uint32_t set_idx)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    return opt->heaps[(size_t)set_idx * opt->associativity];
+}
+
+void opt_replacement_policy_cleanup(struct replacement_policy *replacement_policy)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    free(opt->keys);
+    free(opt->heaps);
+    free(opt->slots);
+    free(opt);
+}
+
+static size_t opt_arrays(struct replacement_policy *replacement_policy,
+                         struct policy_array *arrays)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    size_t num_lines = (size_t)opt->sets * opt->associativity;
+    arrays[0] = (struct policy_array){&opt->trace_count, sizeof(uint64_t)};
+    arrays[1] = (struct policy_array){&opt->position, sizeof(uint64_t)};
+    arrays[2] = (struct policy_array){opt->keys, num_lines * sizeof(uint64_t)};
+    arrays[3] = (struct policy_array){opt->heaps, num_lines * sizeof(uint32_t)};
+    arrays[4] = (struct policy_array){opt->slots, num_lines * sizeof(uint32_t)};
+    return 5;
+}
+
+int opt_serialize(struct replacement_policy *replacement_policy, FILE *out)
+{
+    struct policy_array arrays[5];
+    return policy_arrays_serialize(arrays, opt_arrays(replacement_policy, arrays), out);
+}
+
+// The keys are next uses in one particular trace, so a checkpoint can only be
+// continued with a trace of the same length (which must be the same trace).
+int opt_restore(struct replacement_policy *replacement_policy, const uint8_t *data, size_t size)
+{
+    struct opt_data *opt = (struct opt_data *)replacement_policy->data;
+    struct policy_array arrays[5];
+    if (policy_arrays_restore(arrays, opt_arrays(replacement_policy, arrays), data, size) != 0) {
+        return 1;
+    }
+    return opt->trace_count != opt->next_use->count;
+}
+
+struct replacement_policy *opt_replacement_policy_new(uint32_t sets, uint32_t associativity,
+                                                      const struct next_use *next_use)
+{
+    struct replacement_policy *opt_rp = calloc(1, sizeof(struct replacement_policy));
+    opt_rp->cache_access = &opt_cache_access;
+    opt_rp->eviction_index = &opt_eviction_index;
+    opt_rp->repeat = &opt_repeat;
+    opt_rp->cleanup = &opt_replacement_policy_cleanup;
+    opt_rp->serialize = &opt_serialize;
+    opt_rp->restore = &opt_restore;
+
+    // Every key starts at 0, so the zeroed heaps (the identity permutation,
+    // see struct opt_data) are valid.
+    struct opt_data *opt = calloc(1, sizeof(struct opt_data));
+    opt->next_use = next_use;
+    opt->trace_count = next_use->count;
+    opt->sets = sets;
+    opt->associativity = associativity;
+    size_t num_lines = (size_t)sets * associativity;
+    opt->keys = calloc(num_lines, sizeof(uint64_t));
+    opt->heaps = calloc(num_lines, sizeof(uint32_t));
+    opt->slots = calloc(num_lines, sizeof(uint32_t));
+    opt_rp->data = opt;
+    return opt_rp;
+}
+
+struct replacement_policy *replacement_policy_new(const char *name, uint32_t sets,
+                                                  uint32_t associativity, uint64_t seed)
+{
+    if (!strcmp("LRU", name)) {
+        return lru_replacement_policy_new(sets, associativity);
+    } else if (!strcmp("RAND", name)) {
+        return rand_replacement_policy_new(sets, associativity, seed);
+    } else if (!strcmp("LRU_PREFER_CLEAN", name)) {
+        return lru_prefer_clean_replacement_policy_new(sets, associativity);
+    } else if (!strcmp("PLRU", name)) {
+        return plru_replacement_policy_new(sets, associativity);
+    } else if (!strcmp("SRRIP", name)) {
+        return srrip_replacement_policy_new(sets, associativity);
+    } else if (!strcmp("BRRIP", name)) {
+        return brrip_replacement_policy_new(sets, associativity);
+    }
+    return NULL;
 }
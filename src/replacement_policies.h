@@ -1,5 +1,5 @@
 //
-// This file defines the function signatures necessary for creating the three
+// This file defines the function signatures necessary for creating the
 // replacement policies and defines the replacement_policy struct.
 //
 
@@ -7,10 +7,11 @@
 #define REPLACEMENT_POLICIES_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 struct cache_system;
+struct next_use;
 #include "memory_system.h"
 
 // This struct describes the functionality of a replacement policy. The
@@ -48,7 +49,54 @@ struct replacement_policy {
     //  * set_idx: the index of the set that is being accessed.
     //  * tag: the tag within the set that is being accessed.
     void (*cache_access)(struct replacement_policy *replacement_policy,
-                         struct cache_system *cache_system, uint32_t set_idx, uint32_t tag);
+                         struct cache_system *cache_system, uint32_t set_idx, uint64_t tag);
+
+    // This optional function (it may be NULL) is called when a line is
+    // invalidated without being evicted, for example by a multi-level
+    // hierarchy. The line will be refilled before it is chosen for eviction
+    // again.
+    //
+    // Argruments:
+    //  * replacement_policy: the instance of the replacement_policy
+    //  * cache_system: the cache system, which should be treated as readonly.
+    //  * set_idx: the index of the set of the line.
+    //  * way: the index within the set of the line.
+    void (*invalidate)(struct replacement_policy *replacement_policy,
+                       struct cache_system *cache_system, uint32_t set_idx, uint32_t way);
+
+    // This optional function (it may be NULL) is called when a dirty line
+    // becomes clean without being accessed, for example when another core
+    // reads it in the multi-core mode. Its arguments are those of invalidate.
+    void (*clean)(struct replacement_policy *replacement_policy,
+                  struct cache_system *cache_system, uint32_t set_idx, uint32_t way);
+
+    // This optional function (it may be NULL) is called instead of calling
+    // cache_access count more times in a row for the line that was just
+    // accessed, when runs of accesses to the same line are coalesced (see
+    // cache_system_mem_access_run). Policies whose state such repeated
+    // accesses do not change leave it NULL.
+    void (*repeat)(struct replacement_policy *replacement_policy,
+                   struct cache_system *cache_system, uint32_t set_idx, uint64_t tag,
+                   uint64_t count);
+
+    // This optional function (it may be NULL) performs count packed trace
+    // records (see trace.h) in place of the generic access path, with a fused
+    // kernel specialized for the policy and its associativity (see
+    // access_kernel.h). The cache system only calls it when
+    // access_kernel_usable says that the kernel can do all the work. Returns
+    // 0 on success.
+    int (*access_batch)(struct replacement_policy *replacement_policy,
+                        struct cache_system *cache_system, const uint64_t *records,
+                        size_t count);
+
+    // These optional functions (they may be NULL if the policy keeps no state)
+    // save the state of the policy in a checkpoint and load it back (see
+    // checkpoint.h). serialize writes the state to out; restore loads the size
+    // bytes at data, which serialize wrote for a policy of the same geometry.
+    // Both return 0 on success.
+    int (*serialize)(struct replacement_policy *replacement_policy, FILE *out);
+    int (*restore)(struct replacement_policy *replacement_policy, const uint8_t *data,
+                   size_t size);
 
     // This function is called right before the replacement policy is
     // deallocated. You should perform any necessary cleanup operations here.
@@ -65,8 +113,30 @@ struct replacement_policy {
 
 // Constructors for each of the replacement policies.
 struct replacement_policy *lru_replacement_policy_new(uint32_t sets, uint32_t associativity);
-struct replacement_policy *rand_replacement_policy_new(uint32_t sets, uint32_t associativity);
+struct replacement_policy *rand_replacement_policy_new(uint32_t sets, uint32_t associativity,
+                                                       uint64_t seed);
 struct replacement_policy *lru_prefer_clean_replacement_policy_new(uint32_t sets,
                                                                    uint32_t associativity);
+struct replacement_policy *plru_replacement_policy_new(uint32_t sets, uint32_t associativity);
+struct replacement_policy *srrip_replacement_policy_new(uint32_t sets, uint32_t associativity);
+struct replacement_policy *brrip_replacement_policy_new(uint32_t sets, uint32_t associativity);
+
+// OPT needs the next uses of the trace it simulates (see next_use.h), which
+// must outlive the policy. It counts accesses, so every access of that trace
+// must be simulated, in order, by a single cache.
+struct replacement_policy *opt_replacement_policy_new(uint32_t sets, uint32_t associativity,
+                                                      const struct next_use *next_use);
+
+// The name of OPT, which replacement_policy_new cannot construct.
+#define REPLACEMENT_POLICY_OPT "OPT"
+
+// The seed of RAND when none is given.
+#define REPLACEMENT_POLICY_DEFAULT_SEED 1
+
+// Construct the replacement policy with the given name (e.g. "LRU"). Returns
+// NULL if there is no such policy, and for OPT. seed only affects RAND, which
+// draws the same victims for the same seed.
+struct replacement_policy *replacement_policy_new(const char *name, uint32_t sets,
+                                                  uint32_t associativity, uint64_t seed);
 
 #endif
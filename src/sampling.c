@@ -0,0 +1,128 @@
+//
+// This file contains the implementations for the functions defined in
+// sampling.h.
+//
+
+#include "sampling.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+// The two-sided 95% quantile of the normal distribution.
+#define SET_SAMPLING_Z 1.959964
+
+struct set_sampling *set_sampling_new(uint32_t sets, double fraction)
+{
+    struct set_sampling *sampling = calloc(1, sizeof(struct set_sampling));
+    sampling->fraction = fraction;
+    sampling->threshold = fraction >= 1 ? UINT64_C(1) << 32 : (uint64_t)ldexp(fraction, 32);
+    sampling->num_sets = sets;
+    for (uint32_t s = 0; s < sets; s++) {
+        sampling->num_sampled_sets += set_sampling_contains(sampling, s);
+    }
+    if (sampling->num_sampled_sets == 0) {
+        fprintf(stderr, "A sampling fraction of %g samples none of the %u sets.\n", fraction,
+                sets);
+        free(sampling);
+        return NULL;
+    }
+    sampling->sets = calloc(sets, sizeof(struct cache_system_stats));
+    return sampling;
+}
+
+void set_sampling_cleanup(struct set_sampling *sampling)
+{
+    free(sampling->sets);
+    free(sampling);
+}
+
+int set_sampling_mem_access_batch(struct cache_system *cache_system, const uint64_t *records,
+                                  size_t count)
+{
+    struct set_sampling *sampling = cache_system->sampling;
+    sampling->accesses += count;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t address = trace_record_address(records[i]);
+        uint32_t set_idx = (address & cache_system->set_index_mask) >> cache_system->offset_bits;
+        if (!set_sampling_contains(sampling, set_idx)) continue;
+
+        char rw = trace_record_rw(records[i]);
+        if (cache_system_tracing(cache_system)) {
+            printf("%s at 0x%" PRIx64 "\n", (rw == 'R' ? "read" : "write"), address);
+        }
+        struct cache_system_outcome outcome;
+        if (cache_system_mem_access_outcome(cache_system, address, rw, &outcome) != 0) {
+            return 1;
+        }
+        set_sampling_record(sampling, set_idx, &outcome);
+    }
+    return 0;
+}
+
+// The per-set count that set_sampling_ratio estimates.
+static double set_count(const struct cache_system_stats *set, bool dirty)
+{
+    return dirty ? set->dirty_evictions : set->hits;
+}
+
+// Estimate the ratio of hits (or dirty evictions) to accesses of the whole
+// cache, and the variance of that estimate.
+static void set_sampling_ratio(const struct set_sampling *sampling, bool dirty, double *ratio,
+                               double *variance)
+{
+    double sum_a = 0, sum_y = 0;
+    for (uint32_t s = 0; s < sampling->num_sets; s++) {
+        if (!set_sampling_contains(sampling, s)) continue;
+        const struct cache_system_stats *set = &sampling->sets[s];
+        sum_a += set->accesses;
+        sum_y += set_count(set, dirty);
+    }
+    *ratio = sum_a > 0 ? sum_y / sum_a : 0;
+
+    double n = sampling->num_sampled_sets;
+    if (n == sampling->num_sets || sum_a == 0) {
+        // Every set was simulated (or no sampled set was accessed at all).
+        *variance = 0;
+        return;
+    }
+    if (n < 2) {
+        *variance = INFINITY;
+        return;
+    }
+    double sum_d2 = 0;
+    for (uint32_t s = 0; s < sampling->num_sets; s++) {
+        if (!set_sampling_contains(sampling, s)) continue;
+        const struct cache_system_stats *set = &sampling->sets[s];
+        double d = set_count(set, dirty) - *ratio * set->accesses;
+        sum_d2 += d * d;
+    }
+    double mean_a = sum_a / n;
+    *variance = (1 - n / sampling->num_sets) * (sum_d2 / (n - 1)) / (n * mean_a * mean_a);
+}
+
+static struct set_sampling_estimate estimate(double value, double error, double max)
+{
+    struct set_sampling_estimate e = {value, value - error, value + error};
+    if (e.low < 0) e.low = 0;
+    if (e.high > max) e.high = max;
+    return e;
+}
+
+void set_sampling_estimate(const struct set_sampling *sampling, struct set_sampling_result *result)
+{
+    double accesses = sampling->accesses;
+    double ratio, variance;
+
+    set_sampling_ratio(sampling, false, &ratio, &variance);
+    double error = SET_SAMPLING_Z * sqrt(variance);
+    result->hit_ratio = estimate(ratio, error, 1);
+    result->hits = estimate(ratio * accesses, error * accesses, accesses);
+    result->misses = estimate((1 - ratio) * accesses, error * accesses, accesses);
+
+    set_sampling_ratio(sampling, true, &ratio, &variance);
+    error = SET_SAMPLING_Z * sqrt(variance);
+    result->dirty_evictions = estimate(ratio * accesses, error * accesses, accesses);
+}
@@ -0,0 +1,77 @@
+//
+// This file defines set sampling, which approximates a simulation by only
+// simulating a fraction of the sets of a cache.
+//
+// A set is sampled if a hash of its index falls below the fraction, so the
+// sampled sets are spread over the whole cache and the same for every run.
+// Accesses to other sets are dropped as soon as their set index is known.
+//
+// Every access of the trace is still counted, and the hits and dirty
+// evictions of the whole cache are estimated from the sampled sets with a
+// ratio estimator: the hit ratio (and dirty evictions per access) of the
+// sampled sets, applied to all accesses. The 95% confidence intervals treat
+// the sampled sets as a simple random sample of the sets.
+//
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory_system.h"
+
+struct set_sampling {
+    double fraction;
+    uint64_t threshold; // Sets whose hash is below this are sampled.
+    uint32_t num_sets, num_sampled_sets;
+
+    // Every access of the trace, sampled or not.
+    uint64_t accesses;
+
+    // The statistics of every set (only sampled sets are ever updated).
+    struct cache_system_stats *sets;
+};
+
+// An estimate of a count and its 95% confidence interval.
+struct set_sampling_estimate {
+    double value, low, high;
+};
+
+struct set_sampling_result {
+    struct set_sampling_estimate hits, misses, dirty_evictions, hit_ratio;
+};
+
+// Sample the given fraction (0 < fraction <= 1) of the sets. Returns NULL
+// (after printing an error) if no set would be sampled.
+struct set_sampling *set_sampling_new(uint32_t sets, double fraction);
+void set_sampling_cleanup(struct set_sampling *sampling);
+
+static inline bool set_sampling_contains(const struct set_sampling *sampling, uint32_t set_idx)
+{
+    return (((uint64_t)set_idx * UINT64_C(0x9e3779b97f4a7c15)) >> 32) < sampling->threshold;
+}
+
+// Count the outcome of an access to a sampled set.
+static inline void set_sampling_record(struct set_sampling *sampling, uint32_t set_idx,
+                                       const struct cache_system_outcome *outcome)
+{
+    struct cache_system_stats *set = &sampling->sets[set_idx];
+    set->accesses++;
+    if (outcome->hit) {
+        set->hits++;
+    } else {
+        set->misses++;
+    }
+    if (outcome->evicted_state == MODIFIED) set->dirty_evictions++;
+}
+
+// Like cache_system_mem_access_batch, for a cache system with sampling:
+// counts every record, but only simulates those of sampled sets.
+int set_sampling_mem_access_batch(struct cache_system *cache_system, const uint64_t *records,
+                                  size_t count);
+
+// Estimate the statistics of the whole cache.
+void set_sampling_estimate(const struct set_sampling *sampling, struct set_sampling_result *result);
+
+#endif
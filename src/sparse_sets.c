@@ -0,0 +1,78 @@
+//
+// This file contains the implementations for the functions defined in
+// sparse_sets.h.
+//
+
+#include "sparse_sets.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory_system.h"
+
+// Fill a page with invalid lines.
+static void sparse_sets_clear(const struct sparse_sets *sparse, uint8_t *page)
+{
+    uint64_t *tags = (uint64_t *)page;
+    for (size_t i = 0; i < sparse->states_offset / sizeof(uint64_t); i++) {
+        tags[i] = CACHE_TAG_INVALID;
+    }
+    memset(page + sparse->states_offset, INVALID, sparse->page_bytes - sparse->states_offset);
+}
+
+struct sparse_sets *sparse_sets_new(uint32_t sets, uint32_t associativity)
+{
+    struct sparse_sets *sparse = calloc(1, sizeof(struct sparse_sets));
+    sparse->associativity = associativity;
+    while ((1u << sparse->page_bits) < sets &&
+           ((size_t)associativity << (sparse->page_bits + 1)) <= SPARSE_SETS_PAGE_LINES) {
+        sparse->page_bits++;
+    }
+    size_t page_lines = (size_t)associativity << sparse->page_bits;
+    sparse->states_offset = page_lines * sizeof(uint64_t);
+    sparse->page_bytes = (sparse->states_offset + page_lines + 63) & ~(size_t)63;
+
+    sparse->empty = aligned_alloc(64, sparse->page_bytes);
+    sparse_sets_clear(sparse, sparse->empty);
+    sparse->num_pages = ((size_t)sets + (1u << sparse->page_bits) - 1) >> sparse->page_bits;
+    sparse->pages = malloc(sparse->num_pages * sizeof(uint8_t *));
+    for (size_t p = 0; p < sparse->num_pages; p++) {
+        sparse->pages[p] = sparse->empty;
+    }
+    pthread_mutex_init(&sparse->lock, NULL);
+    return sparse;
+}
+
+void sparse_sets_cleanup(struct sparse_sets *sparse)
+{
+    for (size_t c = 0; c < sparse->num_chunks; c++) {
+        free(sparse->chunks[c]);
+    }
+    free(sparse->chunks);
+    free(sparse->pages);
+    free(sparse->empty);
+    pthread_mutex_destroy(&sparse->lock);
+    free(sparse);
+}
+
+void sparse_sets_allocate(struct sparse_sets *sparse, size_t page)
+{
+    pthread_mutex_lock(&sparse->lock);
+    if (sparse->pages[page] == sparse->empty) {
+        if (sparse->left < sparse->page_bytes) {
+            size_t pages_per_chunk = SPARSE_SETS_CHUNK_BYTES / sparse->page_bytes;
+            size_t chunk_bytes = (pages_per_chunk > 0 ? pages_per_chunk : 1) * sparse->page_bytes;
+            sparse->chunks = realloc(sparse->chunks, (sparse->num_chunks + 1) * sizeof(uint8_t *));
+            sparse->next = aligned_alloc(64, chunk_bytes);
+            sparse->chunks[sparse->num_chunks++] = sparse->next;
+            sparse->left = chunk_bytes;
+        }
+        uint8_t *lines = sparse->next;
+        sparse->next += sparse->page_bytes;
+        sparse->left -= sparse->page_bytes;
+        sparse_sets_clear(sparse, lines);
+        sparse->touched_pages++;
+        __atomic_store_n(&sparse->pages[page], lines, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sparse->lock);
+}
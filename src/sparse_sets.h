@@ -0,0 +1,79 @@
+//
+// This file defines sparse set storage: the tags and states of a cache
+// system's lines kept in a paged directory rather than in two flat arrays, so
+// that a very large cache only pays for the sets its trace touches.
+//
+// The sets are grouped into pages of consecutive sets. A page is carved out of
+// an arena of large chunks the first time one of its sets is written; until
+// then, its directory entry points to a shared page of invalid lines, so
+// lookups never check whether a page exists. Pages are allocated under a lock
+// and published atomically, so the set-partitioned parallel simulation can
+// touch sets from several threads at once.
+//
+
+#ifndef SPARSE_SETS_H
+#define SPARSE_SETS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A page holds about this many lines (and at least one set).
+#define SPARSE_SETS_PAGE_LINES 512
+
+// The arena grows in chunks of this many bytes (or of one page, if larger).
+#define SPARSE_SETS_CHUNK_BYTES (1 << 20)
+
+struct sparse_sets {
+    uint8_t **pages; // Per page: its lines, or empty if it was never touched.
+    uint8_t *empty;  // A page of invalid lines, never written.
+    size_t num_pages, touched_pages;
+    uint32_t page_bits; // log2 of the number of sets per page.
+    uint32_t associativity;
+    size_t states_offset; // Within a page: the tags, then the states.
+    size_t page_bytes;
+
+    // The arena, under lock.
+    pthread_mutex_t lock;
+    uint8_t **chunks;
+    size_t num_chunks;
+    uint8_t *next; // The unused end of the last chunk.
+    size_t left;
+};
+
+struct sparse_sets *sparse_sets_new(uint32_t sets, uint32_t associativity);
+void sparse_sets_cleanup(struct sparse_sets *sparse);
+
+// Allocate the page with the given index, unless another thread just did.
+void sparse_sets_allocate(struct sparse_sets *sparse, size_t page);
+
+static inline uint8_t *sparse_sets_page(const struct sparse_sets *sparse, uint32_t set_idx)
+{
+    return __atomic_load_n(&sparse->pages[set_idx >> sparse->page_bits], __ATOMIC_ACQUIRE);
+}
+
+// The tags and the states of set_idx. They must not be written before the set
+// was touched.
+static inline uint64_t *sparse_sets_tags(const struct sparse_sets *sparse, uint32_t set_idx)
+{
+    uint32_t set_in_page = set_idx & ((1u << sparse->page_bits) - 1);
+    return (uint64_t *)sparse_sets_page(sparse, set_idx) +
+           (size_t)set_in_page * sparse->associativity;
+}
+
+static inline uint8_t *sparse_sets_states(const struct sparse_sets *sparse, uint32_t set_idx)
+{
+    uint32_t set_in_page = set_idx & ((1u << sparse->page_bits) - 1);
+    return sparse_sets_page(sparse, set_idx) + sparse->states_offset +
+           (size_t)set_in_page * sparse->associativity;
+}
+
+// Make the lines of set_idx writable, allocating its page on the first touch.
+static inline void sparse_sets_touch(struct sparse_sets *sparse, uint32_t set_idx)
+{
+    if (__builtin_expect(sparse_sets_page(sparse, set_idx) == sparse->empty, 0)) {
+        sparse_sets_allocate(sparse, set_idx >> sparse->page_bits);
+    }
+}
+
+#endif
@@ -0,0 +1,200 @@
+//
+// This file contains the implementation of the LRU_STACK analysis defined in
+// stack_distance.h.
+//
+// Every set count is analyzed during the same walk over the trace. Within
+// each set of each set count, the accesses are numbered consecutively, and a
+// Fenwick tree over those positions marks the position of the most recent
+// access to every line of the set. The distance of an access is then the
+// number of marks after the line's previous position, which is an O(log n)
+// prefix-sum query. The trees grow by one position per access: the node of a
+// new position covers a range whose other entries are already in the tree, so
+// its value follows from two prefix sums.
+//
+// Every line gets a dense id the first time it is seen, and its last position
+// in every set count is stored under that id, so an access costs one hash
+// lookup however many set counts there are. Every position also records the
+// id of its line, and a tree whose positions are mostly stale is renumbered
+// when it fills up, so the trees of one set count hold a few entries per
+// distinct line between them, however long the trace is. The analysis then
+// takes a few dozen bytes per distinct line for every set count, next to the
+// trace.
+//
+// An access to the same line as the access right before it has a distance of
+// zero for every set count and leaves the stack unchanged, so such repeats are
+// counted directly and never given a position.
+//
+
+#include "stack_distance.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_map.h"
+
+// Distances are bucketed by their bit length: bucket 0 holds distance 0 and
+// bucket b holds distances in [2^(b-1), 2^b).
+#define STACK_DISTANCE_BUCKETS 65
+
+// Marks a position in set_tree.ids whose access was not the last one to its
+// line.
+#define SET_TREE_STALE UINT32_MAX
+
+// The Fenwick tree of one set at one set count. Positions start at 1, and
+// tree[0] is unused. ids[i] is the id of the line whose last access is at
+// position i, and live is the number of such positions.
+struct set_tree {
+    uint32_t *tree, *ids;
+    uint32_t size, capacity, live;
+};
+
+// The number of marks at positions [1, i].
+static inline uint64_t set_tree_prefix(const struct set_tree *t, uint32_t i)
+{
+    uint64_t sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += t->tree[i];
+    }
+    return sum;
+}
+
+static inline void set_tree_remove(struct set_tree *t, uint32_t i)
+{
+    t->ids[i] = SET_TREE_STALE;
+    t->live--;
+    for (; i <= t->size; i += i & -i) {
+        t->tree[i]--;
+    }
+}
+
+// Renumber the marked positions to 1..live, keeping their order, and store
+// the new position of every line in last_positions[id * stride].
+static void set_tree_compact(struct set_tree *t, uint32_t *last_positions, size_t stride)
+{
+    uint32_t size = 0;
+    for (uint32_t i = 1; i <= t->size; i++) {
+        if (t->ids[i] == SET_TREE_STALE) continue;
+        t->ids[++size] = t->ids[i];
+        last_positions[t->ids[size] * stride] = size;
+    }
+    // Every position is marked, so each node holds the length of its range.
+    for (uint32_t i = 1; i <= size; i++) {
+        t->tree[i] = i & -i;
+    }
+    t->size = size;
+}
+
+// Mark a new position after the last one for the line with the given id, and
+// return it. A full tree is compacted instead of grown when at most half of
+// its positions are marked, so its size stays within a few times the number of
+// lines in the set.
+static inline uint32_t set_tree_append(struct set_tree *t, uint32_t id, uint32_t *last_positions,
+                                       size_t stride)
+{
+    if (t->size + 1 >= t->capacity) {
+        if (t->size > 2 * t->live) {
+            set_tree_compact(t, last_positions, stride);
+        } else {
+            t->capacity = t->capacity ? 2 * t->capacity : 4;
+            t->tree = realloc(t->tree, t->capacity * sizeof(uint32_t));
+            t->ids = realloc(t->ids, t->capacity * sizeof(uint32_t));
+        }
+    }
+    uint32_t i = ++t->size;
+    t->tree[i] = 1 + set_tree_prefix(t, i - 1) - set_tree_prefix(t, i - (i & -i));
+    t->ids[i] = id;
+    t->live++;
+    return i;
+}
+
+static inline unsigned distance_bucket(uint64_t distance)
+{
+    return distance == 0 ? 0 : 64 - __builtin_clzll(distance);
+}
+
+int lru_stack_analyze(const struct trace *trace, uint32_t line_size, size_t max_cache_size,
+                      FILE *out)
+{
+    if (line_size == 0 || (line_size & (line_size - 1)) != 0 || max_cache_size < line_size) {
+        fprintf(stderr, "The line size must be a power of two no larger than the cache size.\n");
+        return 1;
+    }
+    unsigned offset_bits = __builtin_ctz(line_size);
+    unsigned max_lines_bits = 63 - __builtin_clzll(max_cache_size / line_size);
+    unsigned levels = max_lines_bits + 1;
+
+    uint64_t(*histograms)[STACK_DISTANCE_BUCKETS] = calloc(levels, sizeof(*histograms));
+
+    // The sets of the set count 2^k are trees[2^k - 1, 2^(k+1) - 1).
+    size_t num_trees = ((size_t)2 << max_lines_bits) - 1;
+    struct set_tree *trees = calloc(num_trees, sizeof(struct set_tree));
+
+    // Per line id, its last position in every set count.
+    struct line_map ids;
+    line_map_init(&ids, 1024);
+    uint32_t *last_positions = NULL;
+    size_t num_lines = 0, lines_capacity = 0;
+
+    uint64_t repeats = 0;
+    uint64_t previous_line = LINE_MAP_EMPTY;
+    for (size_t i = 0; i < trace->count; i++) {
+        uint64_t line = trace_record_address(trace->records[i]) >> offset_bits;
+        if (line == previous_line) {
+            repeats++;
+            continue;
+        }
+        previous_line = line;
+
+        bool inserted;
+        uint64_t *id = line_map_insert(&ids, line, &inserted);
+        if (inserted) {
+            if (num_lines == lines_capacity) {
+                lines_capacity = lines_capacity ? 2 * lines_capacity : 1024;
+                last_positions =
+                    realloc(last_positions, lines_capacity * levels * sizeof(uint32_t));
+            }
+            *id = num_lines++;
+        }
+        uint32_t *last = &last_positions[*id * levels];
+        for (unsigned k = 0; k < levels; k++) {
+            struct set_tree *t = &trees[((size_t)1 << k) - 1 + (line & (((size_t)1 << k) - 1))];
+            if (!inserted) {
+                uint64_t distance = set_tree_prefix(t, t->size) - set_tree_prefix(t, last[k]);
+                histograms[k][distance_bucket(distance)]++;
+                set_tree_remove(t, last[k]);
+            }
+            last[k] = set_tree_append(t, *id, last_positions + k, levels);
+        }
+    }
+    for (unsigned k = 0; k < levels; k++) {
+        histograms[k][0] += repeats;
+    }
+
+    // Report every geometry, ordered by cache size and then associativity.
+    fprintf(out, "policy,cache_size,cache_lines,associativity,accesses,hits,misses,hit_ratio\n");
+    for (unsigned lines_bits = 0; lines_bits <= max_lines_bits; lines_bits++) {
+        for (unsigned assoc_bits = 0; assoc_bits <= lines_bits; assoc_bits++) {
+            const uint64_t *histogram = histograms[lines_bits - assoc_bits];
+            uint64_t hits = 0;
+            for (unsigned b = 0; b <= assoc_bits; b++) {
+                hits += histogram[b];
+            }
+            size_t cache_lines = (size_t)1 << lines_bits;
+            fprintf(out, "LRU_STACK,%zu,%zu,%zu,%zu,%" PRIu64 ",%" PRIu64 ",%.8f\n",
+                    cache_lines * line_size, cache_lines, (size_t)1 << assoc_bits, trace->count,
+                    hits, (uint64_t)(trace->count - hits), (double)hits / trace->count);
+        }
+    }
+
+    for (size_t t = 0; t < num_trees; t++) {
+        free(trees[t].tree);
+        free(trees[t].ids);
+    }
+    free(trees);
+    free(last_positions);
+    line_map_cleanup(&ids);
+    free(histograms);
+    return 0;
+}
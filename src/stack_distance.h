@@ -0,0 +1,30 @@
+//
+// This file defines the LRU_STACK analysis, which computes the LRU hit/miss
+// counts of every power-of-two cache geometry with a given line size in a
+// single pass over the trace, using Mattson stack distances. Its memory grows
+// with the number of distinct lines times the number of set counts, not with
+// the length of the trace (see stack_distance.c).
+//
+// For a cache with S sets, the stack distance of an access is the number of
+// distinct lines in the same set that were used since the last access to the
+// same line. Under LRU, an access hits in an A-way cache with S sets exactly
+// when its distance is less than A, so one histogram per set count gives the
+// results for every associativity.
+//
+
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "trace.h"
+
+// Print one CSV row (in the same columns as "cachesim sweep", minus dirty
+// evictions) for every power-of-two cache with the given line size that is
+// no larger than max_cache_size. Returns 0 on success.
+int lru_stack_analyze(const struct trace *trace, uint32_t line_size, size_t max_cache_size,
+                      FILE *out);
+
+#endif
@@ -0,0 +1,444 @@
+//
+// This file contains the implementation of the parameter sweep mode defined
+// in sweep.h.
+//
+// The grid comes from the command line (-p, -s, -l, -a) or from a config file
+// (-c) with one "key = value,value,..." line per dimension, where the keys are
+// policies, sizes, lines, and assocs. Every configuration is simulated by one
+// of a pool of worker threads, which share the decoded trace read-only.
+//
+
+#include "sweep.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory_system.h"
+#include "next_use.h"
+#include "replacement_policies.h"
+#include "trace.h"
+
+// A comma-separated list of values for one dimension of the grid.
+struct sweep_list {
+    char **items;
+    size_t count;
+};
+
+struct sweep_config {
+    const char *policy;
+    size_t cache_size, cache_lines, associativity;
+    uint64_t seed;
+
+    // The results of the simulation.
+    bool valid;
+    struct cache_system_stats stats;
+};
+
+struct sweep {
+    const struct trace *trace;
+    struct sweep_config *configs; // The seeds of a configuration are consecutive.
+    size_t num_configs;
+    size_t num_seeds;
+    bool coalesce; // Coalesce runs of accesses to the same line (see memory_system.h).
+    atomic_size_t next_config; // The next configuration to hand to a worker.
+};
+
+static void sweep_usage(void)
+{
+    fprintf(stderr,
+            "Usage: cachesim sweep [-j threads] [-f csv|json] [-t trace_file] [-c config_file]\n"
+            "                      [-p policies] [-s cache_sizes] [-l cache_lines] "
+            "[-a associativities]\n"
+            "                      [-S seed] [-n seeds] [-m]\n");
+}
+
+// Replace the list with the comma-separated values in str.
+static void sweep_list_parse(struct sweep_list *list, const char *str)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+
+    char *copy = strdup(str);
+    char *saveptr;
+    for (char *item = strtok_r(copy, ", \t\n", &saveptr); item != NULL;
+         item = strtok_r(NULL, ", \t\n", &saveptr)) {
+        list->items = realloc(list->items, (list->count + 1) * sizeof(char *));
+        list->items[list->count++] = strdup(item);
+    }
+    free(copy);
+}
+
+static void sweep_list_cleanup(struct sweep_list *list)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+}
+
+// Read a grid from a config file. Returns 0 on success.
+static int sweep_read_config(const char *path, struct sweep_list lists[4])
+{
+    static const char *keys[4] = {"policies", "sizes", "lines", "assocs"};
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char line[4096];
+    for (int line_no = 1; fgets(line, sizeof(line), f) != NULL; line_no++) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char *key = line + strspn(line, " \t\r\n");
+        if (*key == '\0') continue;
+
+        char *eq = strchr(key, '=');
+        if (eq == NULL) {
+            fprintf(stderr, "%s:%d: expected 'key = value,...'\n", path, line_no);
+            fclose(f);
+            return 1;
+        }
+        *eq = '\0';
+        key[strcspn(key, " \t")] = '\0';
+
+        int i;
+        for (i = 0; i < 4 && strcmp(keys[i], key); i++) {
+        }
+        if (i == 4) {
+            fprintf(stderr, "%s:%d: unknown key %s\n", path, line_no, key);
+            fclose(f);
+            return 1;
+        }
+        sweep_list_parse(&lists[i], eq + 1);
+    }
+    fclose(f);
+    return 0;
+}
+
+static bool is_power_of_two(size_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+static void sweep_simulate(const struct sweep *sweep, struct sweep_config *config)
+{
+    const struct trace *trace = sweep->trace;
+    if (config->cache_lines == 0 || config->associativity == 0 ||
+        config->cache_size % config->cache_lines != 0 ||
+        config->cache_lines % config->associativity != 0 ||
+        !is_power_of_two(config->cache_size / config->cache_lines) ||
+        !is_power_of_two(config->cache_lines / config->associativity)) {
+        return;
+    }
+    uint32_t line_size = config->cache_size / config->cache_lines;
+    uint32_t sets = config->cache_lines / config->associativity;
+
+    struct cache_system *cache_system = cache_system_new(line_size, sets, config->associativity);
+    if (cache_system == NULL) {
+        return;
+    }
+    cache_system->coalesce = sweep->coalesce;
+    // OPT gets the next uses of the trace for its own line size.
+    struct next_use *next_use = NULL;
+    if (!strcmp(config->policy, REPLACEMENT_POLICY_OPT)) {
+        next_use = next_use_build(trace, line_size);
+        if (next_use == NULL) {
+            cache_system_cleanup(cache_system);
+            free(cache_system);
+            return;
+        }
+        cache_system->replacement_policy =
+            opt_replacement_policy_new(sets, config->associativity, next_use);
+    } else {
+        cache_system->replacement_policy =
+            replacement_policy_new(config->policy, sets, config->associativity, config->seed);
+    }
+
+    if (cache_system_mem_access_batch(cache_system, trace->records, trace->count) == 0) {
+        config->stats = cache_system->stats;
+        config->valid = true;
+    }
+
+    cache_system_cleanup(cache_system);
+    free(cache_system);
+    if (next_use != NULL) {
+        next_use_cleanup(next_use);
+    }
+}
+
+static void *sweep_worker(void *arg)
+{
+    struct sweep *sweep = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add_explicit(&sweep->next_config, 1, memory_order_relaxed);
+        if (i >= sweep->num_configs) break;
+        sweep_simulate(sweep, &sweep->configs[i]);
+    }
+    return NULL;
+}
+
+// The two-sided 95% quantile of Student's t distribution with df degrees of
+// freedom.
+static double student_t_quantile(size_t df)
+{
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df <= 30) return table[df - 1];
+
+    // The Cornish-Fisher expansion around the normal quantile.
+    double z = 1.959964, n = df;
+    return z + (z * z * z + z) / (4 * n) + (5 * pow(z, 5) + 16 * pow(z, 3) + 3 * z) / (96 * n * n);
+}
+
+// Print one row per configuration with the hit ratio over its seeds.
+static void sweep_print_seeds(const struct sweep *sweep, bool json)
+{
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("policy,cache_size,cache_lines,associativity,seeds,accesses,hit_ratio_mean,"
+               "hit_ratio_stddev,hit_ratio_ci_low,hit_ratio_ci_high\n");
+    }
+
+    bool first = true;
+    for (size_t i = 0; i < sweep->num_configs; i += sweep->num_seeds) {
+        const struct sweep_config *c = &sweep->configs[i];
+        if (!c->valid) {
+            fprintf(stderr, "Skipping invalid configuration %s %zu %zu %zu\n", c->policy,
+                    c->cache_size, c->cache_lines, c->associativity);
+            continue;
+        }
+        size_t n = sweep->num_seeds;
+        double sum = 0;
+        for (size_t k = 0; k < n; k++) {
+            sum += (double)c[k].stats.hits / c[k].stats.accesses;
+        }
+        double mean = sum / n, sum_squares = 0;
+        for (size_t k = 0; k < n; k++) {
+            double deviation = (double)c[k].stats.hits / c[k].stats.accesses - mean;
+            sum_squares += deviation * deviation;
+        }
+        double stddev = sqrt(sum_squares / (n - 1));
+        double error = student_t_quantile(n - 1) * stddev / sqrt(n);
+        if (json) {
+            printf("%s  {\"policy\": \"%s\", \"cache_size\": %zu, \"cache_lines\": %zu, "
+                   "\"associativity\": %zu, \"seeds\": %zu, \"accesses\": %" PRIu64
+                   ", \"hit_ratio_mean\": %.8f, \"hit_ratio_stddev\": %.8f, "
+                   "\"hit_ratio_ci_low\": %.8f, \"hit_ratio_ci_high\": %.8f}",
+                   first ? "" : ",\n", c->policy, c->cache_size, c->cache_lines,
+                   c->associativity, n, c->stats.accesses, mean, stddev, mean - error,
+                   mean + error);
+        } else {
+            printf("%s,%zu,%zu,%zu,%zu,%" PRIu64 ",%.8f,%.8f,%.8f,%.8f\n", c->policy,
+                   c->cache_size, c->cache_lines, c->associativity, n, c->stats.accesses, mean,
+                   stddev, mean - error, mean + error);
+        }
+        first = false;
+    }
+
+    if (json) {
+        printf("\n]\n");
+    }
+}
+
+static void sweep_print(const struct sweep *sweep, bool json)
+{
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("policy,cache_size,cache_lines,associativity,accesses,hits,misses,"
+               "dirty_evictions,hit_ratio\n");
+    }
+
+    bool first = true;
+    for (size_t i = 0; i < sweep->num_configs; i++) {
+        const struct sweep_config *c = &sweep->configs[i];
+        if (!c->valid) {
+            fprintf(stderr, "Skipping invalid configuration %s %zu %zu %zu\n", c->policy,
+                    c->cache_size, c->cache_lines, c->associativity);
+            continue;
+        }
+        double hit_ratio = (double)c->stats.hits / c->stats.accesses;
+        if (json) {
+            printf("%s  {\"policy\": \"%s\", \"cache_size\": %zu, \"cache_lines\": %zu, "
+                   "\"associativity\": %zu, \"accesses\": %" PRIu64 ", \"hits\": %" PRIu64
+                   ", \"misses\": %" PRIu64 ", \"dirty_evictions\": %" PRIu64
+                   ", \"hit_ratio\": %.8f}",
+                   first ? "" : ",\n", c->policy, c->cache_size, c->cache_lines,
+                   c->associativity, c->stats.accesses, c->stats.hits, c->stats.misses,
+                   c->stats.dirty_evictions, hit_ratio);
+        } else {
+            printf("%s,%zu,%zu,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.8f\n",
+                   c->policy, c->cache_size, c->cache_lines, c->associativity, c->stats.accesses,
+                   c->stats.hits, c->stats.misses, c->stats.dirty_evictions, hit_ratio);
+        }
+        first = false;
+    }
+
+    if (json) {
+        printf("\n]\n");
+    }
+}
+
+int sweep_main(int argc, char **argv)
+{
+    struct sweep_list lists[4] = {{0}}; // policies, sizes, lines, assocs
+    const char *trace_path = NULL;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool json = false;
+    uint64_t seed = REPLACEMENT_POLICY_DEFAULT_SEED;
+    long num_seeds = 1;
+    bool coalesce = false;
+    int ret = 1;
+
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "hj:f:t:c:p:s:l:a:S:n:m")) != -1) {
+        switch (opt) {
+        case 'h':
+            sweep_usage();
+            ret = 0;
+            goto out;
+        case 'j':
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+        case 'f':
+            if (!strcmp("json", optarg)) {
+                json = true;
+            } else if (!strcmp("csv", optarg)) {
+                json = false;
+            } else {
+                fprintf(stderr, "Unknown output format %s\n", optarg);
+                goto out;
+            }
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'c':
+            if (sweep_read_config(optarg, lists) != 0) goto out;
+            break;
+        case 'p':
+            sweep_list_parse(&lists[0], optarg);
+            break;
+        case 's':
+            sweep_list_parse(&lists[1], optarg);
+            break;
+        case 'l':
+            sweep_list_parse(&lists[2], optarg);
+            break;
+        case 'a':
+            sweep_list_parse(&lists[3], optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            num_seeds = strtol(optarg, NULL, 10);
+            break;
+        case 'm':
+            coalesce = true;
+            break;
+        default:
+            sweep_usage();
+            goto out;
+        }
+    }
+    if (optind != argc || num_threads < 1 || num_seeds < 1) {
+        sweep_usage();
+        goto out;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (lists[i].count == 0) {
+            fprintf(stderr, "The sweep needs at least one policy, size, line count, and "
+                            "associativity.\n");
+            goto out;
+        }
+    }
+
+    // Build the grid.
+    struct sweep sweep = {0};
+    sweep.num_seeds = num_seeds;
+    sweep.coalesce = coalesce;
+    sweep.num_configs =
+        lists[0].count * lists[1].count * lists[2].count * lists[3].count * num_seeds;
+    sweep.configs = calloc(sweep.num_configs, sizeof(struct sweep_config));
+    size_t n = 0;
+    for (size_t p = 0; p < lists[0].count; p++) {
+        // Reject unknown policies up front rather than once per configuration.
+        if (strcmp(lists[0].items[p], REPLACEMENT_POLICY_OPT)) {
+            struct replacement_policy *rp =
+                replacement_policy_new(lists[0].items[p], 1, 1, seed);
+            if (rp == NULL) {
+                fprintf(stderr, "Unknown replacement policy %s\n", lists[0].items[p]);
+                free(sweep.configs);
+                goto out;
+            }
+            rp->cleanup(rp);
+            free(rp);
+        }
+
+        for (size_t s = 0; s < lists[1].count; s++) {
+            for (size_t l = 0; l < lists[2].count; l++) {
+                for (size_t a = 0; a < lists[3].count; a++) {
+                    for (long k = 0; k < num_seeds; k++) {
+                        struct sweep_config *c = &sweep.configs[n++];
+                        c->policy = lists[0].items[p];
+                        c->cache_size = strtoul(lists[1].items[s], NULL, 10);
+                        c->cache_lines = strtoul(lists[2].items[l], NULL, 10);
+                        c->associativity = strtoul(lists[3].items[a], NULL, 10);
+                        c->seed = seed + k;
+                    }
+                }
+            }
+        }
+    }
+
+    // Decode the trace once and simulate every configuration over it.
+    struct trace trace;
+    if (trace_load(trace_path, &trace) != 0) {
+        free(sweep.configs);
+        goto out;
+    }
+    sweep.trace = &trace;
+    atomic_init(&sweep.next_config, 0);
+
+    if ((size_t)num_threads > sweep.num_configs) num_threads = sweep.num_configs;
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    for (long i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, sweep_worker, &sweep);
+    }
+    for (long i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (num_seeds > 1) {
+        sweep_print_seeds(&sweep, json);
+    } else {
+        sweep_print(&sweep, json);
+    }
+    trace_cleanup(&trace);
+    free(sweep.configs);
+    ret = 0;
+
+out:
+    for (int i = 0; i < 4; i++) {
+        sweep_list_cleanup(&lists[i]);
+    }
+    return ret;
+}
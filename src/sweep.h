@@ -0,0 +1,19 @@
+//
+// This file defines the parameter sweep mode. A sweep decodes a trace once
+// into memory and simulates every combination of a grid of replacement
+// policies, cache sizes, cache line counts, and associativities over it in
+// parallel, printing one CSV or JSON row per configuration.
+//
+// With several seeds, every configuration is simulated once per seed (which
+// only changes the victims of RAND), and each row instead gives the mean of
+// the hit ratio over the seeds with its standard deviation and 95% confidence
+// interval: a Monte Carlo estimate for randomized policies.
+//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+// The entrypoint of "cachesim sweep". argv[0] is "sweep".
+int sweep_main(int argc, char **argv);
+
+#endif
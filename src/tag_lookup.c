@@ -0,0 +1,142 @@
+//
+// This file contains the implementations for the functions defined in
+// tag_lookup.h.
+//
+// The vector implementations are compiled with per-function target attributes
+// so that the rest of the simulator does not require the instruction sets;
+// they are only called after tag_lookup_best has checked the CPU.
+//
+
+#include "tag_lookup.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAG_LOOKUP_X86 1
+#endif
+
+int tag_lookup_scalar(const uint64_t *tags, uint32_t associativity, uint64_t tag)
+{
+    for (uint32_t i = 0; i < associativity; i++) {
+        if (tags[i] == tag) return i;
+    }
+    return -1;
+}
+
+#ifdef TAG_LOOKUP_X86
+__attribute__((target("sse4.1"))) int tag_lookup_sse41(const uint64_t *tags,
+                                                       uint32_t associativity, uint64_t tag)
+{
+    __m128i needle = _mm_set1_epi64x(tag);
+    uint32_t i = 0;
+    for (; i + 4 <= associativity; i += 4) {
+        __m128i a = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)(tags + i)), needle);
+        __m128i b = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)(tags + i + 2)), needle);
+        unsigned mask = _mm_movemask_pd(_mm_castsi128_pd(a)) |
+                        _mm_movemask_pd(_mm_castsi128_pd(b)) << 2;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    for (; i < associativity; i++) {
+        if (tags[i] == tag) return i;
+    }
+    return -1;
+}
+
+__attribute__((target("avx2"))) int tag_lookup_avx2(const uint64_t *tags, uint32_t associativity,
+                                                    uint64_t tag)
+{
+    __m256i needle = _mm256_set1_epi64x(tag);
+    uint32_t i = 0;
+    for (; i + 8 <= associativity; i += 8) {
+        __m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i)), needle);
+        __m256i b =
+            _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i + 4)), needle);
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(a)) |
+                        _mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 4 <= associativity) {
+        __m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(tags + i)), needle);
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(a));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 4;
+    }
+    for (; i < associativity; i++) {
+        if (tags[i] == tag) return i;
+    }
+    return -1;
+}
+
+__attribute__((target("avx512f"))) int tag_lookup_avx512(const uint64_t *tags,
+                                                         uint32_t associativity, uint64_t tag)
+{
+    __m512i needle = _mm512_set1_epi64(tag);
+    uint32_t i = 0;
+    for (; i + 16 <= associativity; i += 16) {
+        unsigned mask =
+            _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(tags + i), needle) |
+            (unsigned)_mm512_cmpeq_epi64_mask(_mm512_loadu_si512(tags + i + 8), needle) << 8;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i < associativity) {
+        // Masked loads never touch the ways past the end of the set.
+        __mmask8 valid = (1u << (associativity - i < 8 ? associativity - i : 8)) - 1;
+        unsigned mask =
+            _mm512_mask_cmpeq_epi64_mask(valid, _mm512_maskz_loadu_epi64(valid, tags + i), needle);
+        if (mask) return i + __builtin_ctz(mask);
+        i += 8;
+    }
+    if (i < associativity) {
+        __mmask8 valid = (1u << (associativity - i)) - 1;
+        unsigned mask =
+            _mm512_mask_cmpeq_epi64_mask(valid, _mm512_maskz_loadu_epi64(valid, tags + i), needle);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return -1;
+}
+
+#else
+// Without x86 vector extensions, every lookup is scalar.
+int tag_lookup_sse41(const uint64_t *tags, uint32_t associativity, uint64_t tag)
+{
+    return tag_lookup_scalar(tags, associativity, tag);
+}
+
+int tag_lookup_avx2(const uint64_t *tags, uint32_t associativity, uint64_t tag)
+{
+    return tag_lookup_scalar(tags, associativity, tag);
+}
+
+int tag_lookup_avx512(const uint64_t *tags, uint32_t associativity, uint64_t tag)
+{
+    return tag_lookup_scalar(tags, associativity, tag);
+}
+#endif
+
+int (*tag_lookup_best(void))(const uint64_t *tags, uint32_t associativity, uint64_t tag)
+{
+#ifdef TAG_LOOKUP_X86
+    __builtin_cpu_init();
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_sse41 = __builtin_cpu_supports("sse4.1");
+#else
+    bool has_avx512 = false, has_avx2 = false, has_sse41 = false;
+#endif
+
+    const char *choice = getenv("CACHESIM_TAG_LOOKUP");
+    if (choice != NULL) {
+        if (!strcmp(choice, "scalar")) return tag_lookup_scalar;
+        if (!strcmp(choice, "sse41") && has_sse41) return tag_lookup_sse41;
+        if (!strcmp(choice, "avx2") && has_avx2) return tag_lookup_avx2;
+        if (!strcmp(choice, "avx512") && has_avx512) return tag_lookup_avx512;
+    }
+
+    if (has_avx512) return tag_lookup_avx512;
+    if (has_avx2) return tag_lookup_avx2;
+    if (has_sse41) return tag_lookup_sse41;
+    return tag_lookup_scalar;
+}
@@ -0,0 +1,28 @@
+//
+// This file defines the tag lookup functions, which search the tags of one set
+// for a given tag.
+//
+// There is a scalar implementation and SSE4.1, AVX2, and AVX-512 ones that
+// compare 2, 4, and 8 ways per instruction and turn the comparisons into a hit
+// mask. tag_lookup_best picks the fastest implementation that the CPU
+// supports at runtime.
+//
+
+#ifndef TAG_LOOKUP_H
+#define TAG_LOOKUP_H
+
+#include <stdint.h>
+
+// Each lookup function returns the first way in tags[0, associativity) whose
+// tag equals tag, or -1 if there is none.
+int tag_lookup_scalar(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+int tag_lookup_sse41(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+int tag_lookup_avx2(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+int tag_lookup_avx512(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+
+// Return the fastest lookup function supported by the CPU. Setting the
+// CACHESIM_TAG_LOOKUP environment variable to scalar, sse41, avx2, or avx512
+// overrides the choice (if the CPU supports it).
+int (*tag_lookup_best(void))(const uint64_t *tags, uint32_t associativity, uint64_t tag);
+
+#endif
@@ -0,0 +1,740 @@
+//
+// This file contains the implementations for the functions defined in
+// trace.h.
+//
+
+#include "trace.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef CACHESIM_ZSTD
+#include <zstd.h>
+#endif
+
+// The size of the buffer used when the trace cannot be memory-mapped.
+#define TRACE_CHUNK_SIZE (1 << 20)
+
+// The pipeline of a compressed trace has this many buffers of this many
+// records (a multiple of TRACE_BATCH_SIZE) in flight.
+#define TRACE_PIPELINE_BUFFERS 4
+#define TRACE_PIPELINE_BUFFER_RECORDS (1 << 16)
+
+enum trace_compression {
+    TRACE_UNCOMPRESSED,
+    TRACE_GZIP,
+    TRACE_ZSTD,
+};
+
+// Decompresses a trace, either from memory (a mapped file) or from a file
+// descriptor in chunks.
+struct trace_decompressor {
+    enum trace_compression format;
+    int fd; // -1 if all of the input is in memory.
+
+    // The compressed bytes that are currently available.
+    const uint8_t *input;
+    size_t size;
+    size_t pos;
+    bool eof;
+    uint8_t *buffer; // The chunk buffer (only used when reading from fd).
+
+    // Whether the current gzip member or zstd frame has ended. Another one
+    // may follow it.
+    bool stream_ended;
+
+    z_stream zlib;
+#ifdef CACHESIM_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+// A buffer of records parsed by the pipeline thread.
+struct trace_pipeline_buffer {
+    uint64_t records[TRACE_PIPELINE_BUFFER_RECORDS];
+    size_t count;
+    int end; // 1 after the last record of the trace, -1 after an error.
+};
+
+// A thread that reads a compressed trace with its own reader and hands the
+// records to the simulating thread through a single-producer/single-consumer
+// ring of buffers, like the rings of the parallel simulation. The head is
+// only written by the consumer and the tail only by the thread.
+struct trace_pipeline {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_bool stop; // Set when the trace is closed before its end.
+
+    struct trace_reader *reader;
+    pthread_t thread;
+    size_t pos; // The records of the head buffer already handed out.
+
+    struct trace_pipeline_buffer buffers[TRACE_PIPELINE_BUFFERS];
+};
+
+// Maps every byte to its hex digit value, or to 0xff if it is not a hex digit.
+static const uint8_t hex_value[256] = {
+    [0 ... 255] = 0xff,
+    ['0'] = 0,  ['1'] = 1,  ['2'] = 2,  ['3'] = 3,  ['4'] = 4,  ['5'] = 5,
+    ['6'] = 6,  ['7'] = 7,  ['8'] = 8,  ['9'] = 9,  ['a'] = 10, ['b'] = 11,
+    ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15, ['A'] = 10, ['B'] = 11,
+    ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int trace_reader_refill(struct trace_reader *reader);
+static enum trace_compression trace_reader_detect_compression(const struct trace_reader *reader);
+static int trace_reader_start_pipeline(struct trace_reader *reader,
+                                       enum trace_compression format);
+
+// Check for a binary trace header at the start of the available data. If one
+// is found, it is consumed. Returns -1 if the header is invalid.
+static int trace_reader_detect_format(struct trace_reader *reader)
+{
+    struct trace_file_header header;
+    if (reader->size < sizeof(header) ||
+        memcmp(reader->data, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)) != 0) {
+        return 0;
+    }
+    memcpy(&header, reader->data, sizeof(header));
+    header.version = le32toh(header.version);
+    header.record_size = le32toh(header.record_size);
+    header.record_count = le64toh(header.record_count);
+
+    if (header.version != TRACE_FILE_VERSION || header.record_size != sizeof(uint64_t)) {
+        fprintf(stderr, "%s: unsupported binary trace version %u (record size %u)\n",
+                reader->name, header.version, header.record_size);
+        return -1;
+    }
+    if (reader->mapped &&
+        reader->size != sizeof(header) + header.record_count * sizeof(uint64_t)) {
+        fprintf(stderr, "%s: binary trace has %" PRIu64 " records but its size is %zu bytes\n",
+                reader->name, header.record_count, reader->size);
+        return -1;
+    }
+
+    reader->binary = true;
+    reader->records_remaining = header.record_count;
+    reader->pos = sizeof(header);
+    return 0;
+}
+
+// Start reading a trace whose first bytes are available: hand it to a
+// pipeline thread if it is compressed, or else detect its format.
+static int trace_reader_start(struct trace_reader *reader)
+{
+    enum trace_compression compression = trace_reader_detect_compression(reader);
+    if (compression != TRACE_UNCOMPRESSED) {
+        return trace_reader_start_pipeline(reader, compression);
+    }
+    return trace_reader_detect_format(reader);
+}
+
+struct trace_reader *trace_reader_open(const char *path)
+{
+    struct trace_reader *reader = calloc(1, sizeof(struct trace_reader));
+    reader->line = 1;
+
+    if (path == NULL || !strcmp(path, "-")) {
+        reader->name = "<stdin>";
+        reader->fd = STDIN_FILENO;
+    } else {
+        reader->name = path;
+        reader->fd = open(path, O_RDONLY);
+        if (reader->fd < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            free(reader);
+            return NULL;
+        }
+    }
+
+    // Regular files (including stdin redirected from a file) are mapped in
+    // their entirety. Everything else is read in chunks.
+    struct stat st;
+    if (fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            reader->data = data;
+            reader->size = st.st_size;
+            reader->mapped = true;
+            reader->eof = true;
+            if (trace_reader_start(reader) != 0) {
+                trace_reader_close(reader);
+                return NULL;
+            }
+            return reader;
+        }
+    }
+
+    reader->buffer = malloc(TRACE_CHUNK_SIZE);
+    reader->data = reader->buffer;
+    if (trace_reader_refill(reader) != 0 || trace_reader_start(reader) != 0) {
+        trace_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+static void trace_pipeline_cleanup(struct trace_pipeline *pipeline);
+static void trace_decompressor_cleanup(struct trace_decompressor *decompressor);
+
+void trace_reader_close(struct trace_reader *reader)
+{
+    if (reader->pipeline != NULL) {
+        trace_pipeline_cleanup(reader->pipeline);
+    }
+    if (reader->decompressor != NULL) {
+        trace_decompressor_cleanup(reader->decompressor);
+    }
+    if (reader->mapped) {
+        munmap((void *)reader->data, reader->size);
+    }
+    if (reader->fd >= 0 && reader->fd != STDIN_FILENO) {
+        close(reader->fd);
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+static ssize_t trace_decompressor_read(struct trace_reader *reader, char *out, size_t size);
+
+// Move the unparsed bytes to the front of the chunk buffer and fill the rest
+// of it from the file (or the decompressor). Returns -1 on a read error.
+static int trace_reader_refill(struct trace_reader *reader)
+{
+    size_t remaining = reader->size - reader->pos;
+    memmove(reader->buffer, reader->buffer + reader->pos, remaining);
+    reader->pos = 0;
+    reader->size = remaining;
+
+    while (!reader->eof && reader->size < TRACE_CHUNK_SIZE) {
+        ssize_t n;
+        if (reader->decompressor != NULL) {
+            n = trace_decompressor_read(reader, reader->buffer + reader->size,
+                                        TRACE_CHUNK_SIZE - reader->size);
+            if (n < 0) return -1;
+        } else {
+            n = read(reader->fd, reader->buffer + reader->size, TRACE_CHUNK_SIZE - reader->size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "%s: %s\n", reader->name, strerror(errno));
+                return -1;
+            }
+        }
+        if (n == 0) {
+            reader->eof = true;
+        }
+        reader->size += n;
+    }
+    return 0;
+}
+
+// Read more compressed input into the decompressor's chunk buffer.
+static int trace_decompressor_fill(struct trace_reader *reader)
+{
+    struct trace_decompressor *d = reader->decompressor;
+    size_t remaining = d->size - d->pos;
+    memmove(d->buffer, d->buffer + d->pos, remaining);
+    d->pos = 0;
+    d->size = remaining;
+    while (!d->eof && d->size < TRACE_CHUNK_SIZE) {
+        ssize_t n = read(d->fd, d->buffer + d->size, TRACE_CHUNK_SIZE - d->size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "%s: %s\n", reader->name, strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            d->eof = true;
+        }
+        d->size += n;
+    }
+    return 0;
+}
+
+// Decompress up to size bytes of the trace into out. Returns the number of
+// bytes, 0 at the end of the trace, or -1 (after printing an error).
+static ssize_t trace_decompressor_read(struct trace_reader *reader, char *out, size_t size)
+{
+    struct trace_decompressor *d = reader->decompressor;
+    size_t produced = 0;
+    while (produced < size) {
+        if (d->pos == d->size && !d->eof && trace_decompressor_fill(reader) != 0) {
+            return -1;
+        }
+        bool input_left = d->pos < d->size;
+
+        // Concatenated gzip members and zstd frames are decompressed one
+        // after the other.
+        if (d->stream_ended) {
+            if (!input_left) break;
+            if (d->format == TRACE_GZIP) {
+                inflateReset(&d->zlib);
+            } else {
+#ifdef CACHESIM_ZSTD
+                ZSTD_DCtx_reset(d->zstd, ZSTD_reset_session_only);
+#endif
+            }
+            d->stream_ended = false;
+        }
+        if (!input_left) {
+            fprintf(stderr, "%s: compressed trace is truncated\n", reader->name);
+            return -1;
+        }
+
+        if (d->format == TRACE_GZIP) {
+            d->zlib.next_in = (Bytef *)d->input + d->pos;
+            d->zlib.avail_in = d->size - d->pos;
+            d->zlib.next_out = (Bytef *)out + produced;
+            d->zlib.avail_out = size - produced;
+            int ret = inflate(&d->zlib, Z_NO_FLUSH);
+            d->pos = d->size - d->zlib.avail_in;
+            produced = size - d->zlib.avail_out;
+            if (ret == Z_STREAM_END) {
+                d->stream_ended = true;
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                fprintf(stderr, "%s: %s\n", reader->name,
+                        d->zlib.msg != NULL ? d->zlib.msg : "corrupt gzip data");
+                return -1;
+            }
+        } else {
+#ifdef CACHESIM_ZSTD
+            ZSTD_inBuffer in = {d->input, d->size, d->pos};
+            ZSTD_outBuffer o = {out, size, produced};
+            size_t ret = ZSTD_decompressStream(d->zstd, &o, &in);
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "%s: %s\n", reader->name, ZSTD_getErrorName(ret));
+                return -1;
+            }
+            d->pos = in.pos;
+            produced = o.pos;
+            d->stream_ended = ret == 0;
+#endif
+        }
+    }
+    return produced;
+}
+
+static void trace_decompressor_cleanup(struct trace_decompressor *decompressor)
+{
+    if (decompressor->format == TRACE_GZIP) {
+        inflateEnd(&decompressor->zlib);
+    } else {
+#ifdef CACHESIM_ZSTD
+        ZSTD_freeDStream(decompressor->zstd);
+#endif
+    }
+    free(decompressor->buffer);
+    free(decompressor);
+}
+
+// Identify a compressed trace from the magic number of its format.
+static enum trace_compression trace_reader_detect_compression(const struct trace_reader *reader)
+{
+    static const uint8_t gzip_magic[] = {0x1f, 0x8b};
+    static const uint8_t zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    if (reader->size >= sizeof(gzip_magic) &&
+        memcmp(reader->data, gzip_magic, sizeof(gzip_magic)) == 0) {
+        return TRACE_GZIP;
+    }
+    if (reader->size >= sizeof(zstd_magic) &&
+        memcmp(reader->data, zstd_magic, sizeof(zstd_magic)) == 0) {
+        return TRACE_ZSTD;
+    }
+    return TRACE_UNCOMPRESSED;
+}
+
+static void *trace_pipeline_main(void *arg)
+{
+    struct trace_pipeline *pipeline = arg;
+    for (size_t tail = 0;; tail++) {
+        while (tail - atomic_load_explicit(&pipeline->head, memory_order_acquire) ==
+               TRACE_PIPELINE_BUFFERS) {
+            if (atomic_load_explicit(&pipeline->stop, memory_order_relaxed)) return NULL;
+            sched_yield();
+        }
+
+        struct trace_pipeline_buffer *buffer = &pipeline->buffers[tail % TRACE_PIPELINE_BUFFERS];
+        buffer->count = 0;
+        buffer->end = 0;
+        while (buffer->count + TRACE_BATCH_SIZE <= TRACE_PIPELINE_BUFFER_RECORDS) {
+            const uint64_t *records;
+            ssize_t count = trace_reader_next_batch(pipeline->reader, &records);
+            if (count <= 0) {
+                buffer->end = count < 0 ? -1 : 1;
+                break;
+            }
+            memcpy(buffer->records + buffer->count, records, count * sizeof(uint64_t));
+            buffer->count += count;
+        }
+        atomic_store_explicit(&pipeline->tail, tail + 1, memory_order_release);
+        if (buffer->end != 0) return NULL;
+    }
+}
+
+// Hand out the next batch of the records parsed by the pipeline thread.
+static ssize_t trace_pipeline_next_batch(struct trace_pipeline *pipeline,
+                                         const uint64_t **records)
+{
+    for (;;) {
+        size_t head = atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+        while (atomic_load_explicit(&pipeline->tail, memory_order_acquire) == head) {
+            sched_yield();
+        }
+        struct trace_pipeline_buffer *buffer = &pipeline->buffers[head % TRACE_PIPELINE_BUFFERS];
+        if (pipeline->pos < buffer->count) {
+            size_t count = buffer->count - pipeline->pos;
+            if (count > TRACE_BATCH_SIZE) count = TRACE_BATCH_SIZE;
+            *records = buffer->records + pipeline->pos;
+            pipeline->pos += count;
+            return count;
+        }
+        if (buffer->end != 0) return buffer->end < 0 ? -1 : 0;
+
+        // The caller is done with the previous batch, so the buffer can be
+        // refilled.
+        pipeline->pos = 0;
+        atomic_store_explicit(&pipeline->head, head + 1, memory_order_release);
+    }
+}
+
+static void trace_pipeline_cleanup(struct trace_pipeline *pipeline)
+{
+    atomic_store_explicit(&pipeline->stop, true, memory_order_relaxed);
+    pthread_join(pipeline->thread, NULL);
+    trace_reader_close(pipeline->reader);
+    free(pipeline);
+}
+
+// Start decompressing and parsing the trace of reader, whose start has been
+// read (or mapped), on a pipeline thread. Returns -1 (after printing an error)
+// if the decompressed trace is not valid.
+static int trace_reader_start_pipeline(struct trace_reader *reader,
+                                       enum trace_compression format)
+{
+#ifndef CACHESIM_ZSTD
+    if (format == TRACE_ZSTD) {
+        fprintf(stderr, "%s: zstd-compressed traces need a build with \"make ZSTD=1\"\n",
+                reader->name);
+        return -1;
+    }
+#endif
+
+    // The decompressor takes over the input read so far.
+    struct trace_decompressor *d = calloc(1, sizeof(struct trace_decompressor));
+    d->format = format;
+    if (reader->mapped) {
+        d->fd = -1;
+        d->input = (const uint8_t *)reader->data;
+        d->size = reader->size;
+        d->eof = true;
+    } else {
+        d->fd = reader->fd;
+        d->buffer = (uint8_t *)reader->buffer;
+        d->input = d->buffer;
+        d->size = reader->size;
+        d->pos = reader->pos;
+        d->eof = reader->eof;
+        reader->buffer = NULL;
+        reader->data = NULL;
+        reader->size = reader->pos = 0;
+    }
+    if (format == TRACE_GZIP) {
+        inflateInit2(&d->zlib, 16 + MAX_WBITS);
+    } else {
+#ifdef CACHESIM_ZSTD
+        d->zstd = ZSTD_createDStream();
+#endif
+    }
+
+    struct trace_reader *inner = calloc(1, sizeof(struct trace_reader));
+    inner->name = reader->name;
+    inner->fd = -1;
+    inner->line = 1;
+    inner->decompressor = d;
+    inner->buffer = malloc(TRACE_CHUNK_SIZE);
+    inner->data = inner->buffer;
+    if (trace_reader_refill(inner) != 0 || trace_reader_detect_format(inner) != 0) {
+        trace_reader_close(inner);
+        return -1;
+    }
+
+    struct trace_pipeline *pipeline = aligned_alloc(64, sizeof(struct trace_pipeline));
+    atomic_init(&pipeline->head, 0);
+    atomic_init(&pipeline->tail, 0);
+    atomic_init(&pipeline->stop, false);
+    pipeline->reader = inner;
+    pipeline->pos = 0;
+    pthread_create(&pipeline->thread, NULL, trace_pipeline_main, pipeline);
+    reader->pipeline = pipeline;
+    return 0;
+}
+
+// Parse complete lines from data[pos, limit) into the records array until it
+// is full. Returns the number of records parsed, or -1 on a parse error.
+static ssize_t trace_reader_parse(struct trace_reader *reader, size_t limit)
+{
+    const char *p = reader->data + reader->pos;
+    const char *end = reader->data + limit;
+    uint64_t *records = reader->records;
+    size_t count = 0;
+    const char *error = NULL;
+
+    while (count < TRACE_BATCH_SIZE) {
+        // Skip blank lines and leading whitespace.
+        while (p < end && (is_blank(*p) || *p == '\n')) {
+            reader->line += (*p == '\n');
+            p++;
+        }
+        if (p == end) break;
+
+        // The access type. Anything other than 'W' is treated as a read, as
+        // the original scanf-based reader did, but it is reported.
+        char rw = *p++;
+        if (rw != 'R' && rw != 'W') {
+            fprintf(stderr,
+                    "%s:%" PRIu64 ": warning: unknown access type '%c', treating it as a read\n",
+                    reader->name, reader->line, rw);
+        }
+        while (p < end && is_blank(*p)) p++;
+
+        // The address, with an optional 0x prefix.
+        if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+        const char *digits = p;
+        uint64_t address = 0;
+        uint8_t v;
+        while (p < end && (v = hex_value[(uint8_t)*p]) < 16) {
+            address = (address << 4) | v;
+            p++;
+        }
+        if (p == digits) {
+            error = "expected a hexadecimal address";
+            break;
+        }
+        if (p - digits > 16 || (address >> 63) != 0) {
+            error = "address does not fit in 63 bits";
+            break;
+        }
+
+        // Nothing but whitespace may follow the address.
+        while (p < end && is_blank(*p)) p++;
+        if (p < end && *p != '\n') {
+            error = "unexpected characters after the address";
+            break;
+        }
+
+        records[count++] = trace_record_pack(address, rw);
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "%s:%" PRIu64 ": %s\n", reader->name, reader->line, error);
+        return -1;
+    }
+    reader->pos = p - reader->data;
+    return count;
+}
+
+// Hand out the next batch of binary records. Mapped traces on little-endian
+// hosts are returned in place; otherwise the records are copied (and
+// byte-swapped if needed) into the records array.
+static ssize_t trace_reader_next_binary_batch(struct trace_reader *reader,
+                                              const uint64_t **records)
+{
+    size_t count = reader->records_remaining < TRACE_BATCH_SIZE ? reader->records_remaining
+                                                                : TRACE_BATCH_SIZE;
+    size_t available = (reader->size - reader->pos) / sizeof(uint64_t);
+    if (!reader->mapped && available < count && !reader->eof) {
+        if (trace_reader_refill(reader) != 0) return -1;
+        available = (reader->size - reader->pos) / sizeof(uint64_t);
+    }
+    if (available < count) count = available;
+    if (count == 0) {
+        if (reader->records_remaining != 0) {
+            fprintf(stderr, "%s: binary trace is truncated (%" PRIu64 " records missing)\n",
+                    reader->name, reader->records_remaining);
+            return -1;
+        }
+        return 0;
+    }
+
+    const char *start = reader->data + reader->pos;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (reader->mapped) {
+        *records = (const uint64_t *)start;
+    } else {
+        memcpy(reader->records, start, count * sizeof(uint64_t));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        uint64_t record;
+        memcpy(&record, start + i * sizeof(uint64_t), sizeof(record));
+        reader->records[i] = le64toh(record);
+    }
+#endif
+    reader->pos += count * sizeof(uint64_t);
+    reader->records_remaining -= count;
+    return count;
+}
+
+uint64_t trace_reader_skip(struct trace_reader *reader, uint64_t count)
+{
+    if (reader->pipeline != NULL || !reader->binary) {
+        return 0;
+    }
+    if (count > reader->records_remaining) count = reader->records_remaining;
+
+    // Drop the records that are already available, then seek past the rest
+    // when the file allows it.
+    uint64_t skipped = (reader->size - reader->pos) / sizeof(uint64_t);
+    if (skipped > count) skipped = count;
+    reader->pos += skipped * sizeof(uint64_t);
+    if (!reader->mapped && skipped < count && !reader->eof &&
+        lseek(reader->fd, (count - skipped) * sizeof(uint64_t), SEEK_CUR) != -1) {
+        skipped = count;
+    }
+    reader->records_remaining -= skipped;
+    return skipped;
+}
+
+ssize_t trace_reader_next_batch(struct trace_reader *reader, const uint64_t **records)
+{
+    if (reader->pipeline != NULL) {
+        return trace_pipeline_next_batch(reader->pipeline, records);
+    }
+    *records = reader->records;
+    if (reader->binary) {
+        return trace_reader_next_binary_batch(reader, records);
+    }
+    if (reader->mapped) {
+        return trace_reader_parse(reader, reader->size);
+    }
+
+    for (;;) {
+        // Only parse up to the last complete line unless the whole trace has
+        // been read.
+        size_t limit = reader->size;
+        if (!reader->eof) {
+            while (limit > reader->pos && reader->data[limit - 1] != '\n') limit--;
+        }
+        if (limit > reader->pos) {
+            ssize_t count = trace_reader_parse(reader, limit);
+            if (count != 0) return count;
+        }
+        if (reader->eof && reader->pos == reader->size) return 0;
+
+        if (reader->pos == 0 && reader->size == TRACE_CHUNK_SIZE) {
+            fprintf(stderr, "%s:%" PRIu64 ": line too long\n", reader->name, reader->line);
+            return -1;
+        }
+        if (trace_reader_refill(reader) != 0) return -1;
+    }
+}
+
+int trace_convert(const char *input_path, const char *output_path)
+{
+    struct trace_reader *reader = trace_reader_open(input_path);
+    if (reader == NULL) {
+        return 1;
+    }
+    FILE *out = fopen(output_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+        trace_reader_close(reader);
+        return 1;
+    }
+
+    // The header is written again once the number of records is known.
+    struct trace_file_header header = {.magic = TRACE_FILE_MAGIC};
+    fwrite(&header, sizeof(header), 1, out);
+
+    uint64_t record_count = 0;
+    const uint64_t *records;
+    ssize_t count;
+    uint64_t le_records[TRACE_BATCH_SIZE];
+    while ((count = trace_reader_next_batch(reader, &records)) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            le_records[i] = htole64(records[i]);
+        }
+        fwrite(le_records, sizeof(uint64_t), count, out);
+        record_count += count;
+    }
+    trace_reader_close(reader);
+
+    header.version = htole32(TRACE_FILE_VERSION);
+    header.record_size = htole32(sizeof(uint64_t));
+    header.record_count = htole64(record_count);
+    if (count < 0 || fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fclose(out) != 0) {
+        if (count >= 0) {
+            fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+        }
+        remove(output_path);
+        return 1;
+    }
+    return 0;
+}
+
+int trace_load(const char *path, struct trace *trace)
+{
+    memset(trace, 0, sizeof(struct trace));
+    struct trace_reader *reader = trace_reader_open(path);
+    if (reader == NULL) {
+        return 1;
+    }
+
+    if (reader->binary && reader->mapped && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+        trace->records = (const uint64_t *)(reader->data + reader->pos);
+        trace->count = reader->records_remaining;
+        trace->reader = reader;
+        return 0;
+    }
+
+    size_t capacity = reader->binary ? reader->records_remaining : TRACE_BATCH_SIZE;
+    if (capacity == 0) capacity = 1;
+    uint64_t *owned = malloc(capacity * sizeof(uint64_t));
+    size_t total = 0;
+    const uint64_t *records;
+    ssize_t count;
+    while ((count = trace_reader_next_batch(reader, &records)) > 0) {
+        if (total + count > capacity) {
+            while (total + count > capacity) capacity *= 2;
+            owned = realloc(owned, capacity * sizeof(uint64_t));
+        }
+        memcpy(owned + total, records, count * sizeof(uint64_t));
+        total += count;
+    }
+    trace_reader_close(reader);
+    if (count < 0) {
+        free(owned);
+        return 1;
+    }
+
+    trace->records = owned;
+    trace->count = total;
+    trace->owned = owned;
+    return 0;
+}
+
+void trace_cleanup(struct trace *trace)
+{
+    if (trace->reader != NULL) {
+        trace_reader_close(trace->reader);
+    }
+    free(trace->owned);
+}
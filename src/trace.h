@@ -0,0 +1,123 @@
+//
+// This file defines the trace reader, which turns a memory access trace into
+// batches of packed access records for the simulator.
+//
+// A trace is read either by memory-mapping it (regular files) or in large
+// chunks (pipes and terminals). Two formats are supported and detected
+// automatically:
+//
+//  * Text traces, where each line has the form "R 0x1234" or "W 0x1234".
+//  * Binary traces, which start with a struct trace_file_header followed by
+//    record_count little-endian 64-bit records in the packed format below.
+//    Mapped binary traces are handed to the simulator without any copying.
+//
+// Either format may also be compressed with gzip (or with zstd, when built
+// with "make ZSTD=1"), which is detected from the magic number as well. A
+// compressed trace is decompressed and parsed on a separate thread, which
+// hands the records to the simulator in large buffers, so decompression
+// overlaps with the simulation.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The number of records handed out by each call to trace_reader_next_batch.
+#define TRACE_BATCH_SIZE 4096
+
+// Each access is packed into a single 64-bit record: the address is stored in
+// the upper 63 bits and the lowest bit is set for writes.
+#define TRACE_RECORD_WRITE 1
+
+// The header at the start of every binary trace.
+#define TRACE_FILE_MAGIC "CSIMTRC"
+#define TRACE_FILE_VERSION 1
+struct trace_file_header {
+    char magic[8];         // TRACE_FILE_MAGIC, NUL-padded
+    uint32_t version;      // TRACE_FILE_VERSION
+    uint32_t record_size;  // sizeof(uint64_t)
+    uint64_t record_count; // The number of records following the header
+};
+
+static inline uint64_t trace_record_pack(uint64_t address, char rw)
+{
+    return (address << 1) | (rw == 'W' ? TRACE_RECORD_WRITE : 0);
+}
+
+static inline uint64_t trace_record_address(uint64_t record)
+{
+    return record >> 1;
+}
+
+static inline char trace_record_rw(uint64_t record)
+{
+    return (record & TRACE_RECORD_WRITE) ? 'W' : 'R';
+}
+
+struct trace_reader {
+    const char *name; // The name used in error messages.
+    int fd;
+
+    // The bytes of the trace that are currently available. For a mapped file
+    // this is the whole file, otherwise it is the chunk buffer.
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool mapped;
+    bool eof;
+
+    bool binary;                // Whether this is a binary trace.
+    uint64_t records_remaining; // The records left to read from a binary trace.
+
+    char *buffer; // The chunk buffer (only used when the trace is not mapped).
+    uint64_t line; // The line number of the next unparsed line.
+
+    // For a compressed trace, the thread that decompresses and parses it
+    // (see trace.c), from which this reader only takes the records. The
+    // pipeline's own reader reads the decompressed bytes from decompressor.
+    struct trace_pipeline *pipeline;
+    struct trace_decompressor *decompressor;
+
+    uint64_t records[TRACE_BATCH_SIZE];
+};
+
+// Open a trace. If path is NULL or "-", the trace is read from stdin.
+// Returns NULL (after printing an error) if the trace cannot be opened.
+struct trace_reader *trace_reader_open(const char *path);
+void trace_reader_close(struct trace_reader *reader);
+
+// Parse the next batch of records. On success, *records points to the parsed
+// records (valid until the next call) and the number of records is returned.
+// Returns 0 at the end of the trace and -1 (after printing the offending line
+// number) if the trace is malformed or cannot be read.
+ssize_t trace_reader_next_batch(struct trace_reader *reader, const uint64_t **records);
+
+// Skip up to count records without reading them, and return how many were
+// skipped. Only uncompressed binary traces can be skipped (those that are not
+// mapped only when their file can seek), so this returns 0 for any other
+// trace, whose records still have to be read and parsed.
+uint64_t trace_reader_skip(struct trace_reader *reader, uint64_t count);
+
+// A whole trace decoded into memory. The records are read-only and can be
+// shared between any number of simulations (and threads). Mapped binary
+// traces are used in place; other traces are decoded into an owned array.
+struct trace {
+    const uint64_t *records;
+    size_t count;
+
+    struct trace_reader *reader; // Keeps the mapping of a binary trace alive.
+    uint64_t *owned;             // The decoded records, if they are not mapped.
+};
+
+// Load the whole trace at path (NULL or "-" for stdin). Returns 0 on success.
+int trace_load(const char *path, struct trace *trace);
+void trace_cleanup(struct trace *trace);
+
+// Convert the trace at input_path (in either format) to a binary trace at
+// output_path. Returns 0 on success.
+int trace_convert(const char *input_path, const char *output_path);
+
+#endif
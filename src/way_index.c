@@ -0,0 +1,136 @@
+//
+// This file contains the implementations for the functions defined in
+// way_index.h.
+//
+
+#include "way_index.h"
+
+#include <stdlib.h>
+
+#include "memory_system.h"
+
+static inline uint32_t way_index_home(const struct way_index *index, uint64_t tag)
+{
+    return (tag * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - index->capacity_bits);
+}
+
+static inline uint32_t *way_index_slots(const struct way_index *index, uint32_t set_idx)
+{
+    return &index->slots[(size_t)set_idx * index->capacity];
+}
+
+struct way_index *way_index_new(uint32_t sets, uint32_t associativity)
+{
+    struct way_index *index = calloc(1, sizeof(struct way_index));
+    index->sets = sets;
+    index->associativity = associativity;
+
+    // Keep the load factor at or below one half.
+    index->capacity_bits = 1;
+    while ((1u << index->capacity_bits) < 2 * associativity) index->capacity_bits++;
+    index->capacity = 1u << index->capacity_bits;
+
+    index->slots = calloc((size_t)sets * index->capacity, sizeof(uint32_t));
+    index->filled = calloc(sets, sizeof(uint32_t));
+    index->hole_words = (associativity + 63) / 64;
+    index->holes = calloc((size_t)sets * index->hole_words, sizeof(uint64_t));
+    index->num_holes = calloc(sets, sizeof(uint32_t));
+    return index;
+}
+
+void way_index_cleanup(struct way_index *index)
+{
+    free(index->slots);
+    free(index->filled);
+    free(index->holes);
+    free(index->num_holes);
+    free(index);
+}
+
+int way_index_find(const struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                   uint64_t tag)
+{
+    if (tag == CACHE_TAG_INVALID) {
+        if (index->num_holes[set_idx] > 0) {
+            const uint64_t *holes = &index->holes[(size_t)set_idx * index->hole_words];
+            for (uint32_t w = 0;; w++) {
+                if (holes[w]) return 64 * w + __builtin_ctzll(holes[w]);
+            }
+        }
+        uint32_t filled = index->filled[set_idx];
+        return filled < index->associativity ? (int)filled : -1;
+    }
+
+    const uint32_t *slots = way_index_slots(index, set_idx);
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t i = way_index_home(index, tag);; i = (i + 1) & mask) {
+        uint32_t slot = slots[i];
+        if (slot == WAY_INDEX_EMPTY) return -1;
+        if (set_tags[slot - 1] == tag) return slot - 1;
+    }
+}
+
+void way_index_insert(struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                      uint32_t way)
+{
+    uint32_t *slots = way_index_slots(index, set_idx);
+    uint32_t mask = index->capacity - 1;
+    uint32_t i = way_index_home(index, set_tags[way]);
+    while (slots[i] != WAY_INDEX_EMPTY) i = (i + 1) & mask;
+    slots[i] = way + 1;
+
+    uint64_t *holes = &index->holes[(size_t)set_idx * index->hole_words];
+    if (way == index->filled[set_idx]) {
+        index->filled[set_idx]++;
+    } else if (holes[way / 64] & (UINT64_C(1) << (way % 64))) {
+        holes[way / 64] &= ~(UINT64_C(1) << (way % 64));
+        index->num_holes[set_idx]--;
+    }
+}
+
+void way_index_remove(struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                      uint32_t way)
+{
+    uint32_t *slots = way_index_slots(index, set_idx);
+    uint32_t mask = index->capacity - 1;
+    uint32_t hole = way_index_home(index, set_tags[way]);
+    while (slots[hole] != way + 1) hole = (hole + 1) & mask;
+
+    // Shift later entries of the probe sequence back into the hole, so that
+    // lookups never need tombstones. An entry can fill the hole if the hole
+    // lies between its home slot and its current slot.
+    for (uint32_t i = (hole + 1) & mask; slots[i] != WAY_INDEX_EMPTY; i = (i + 1) & mask) {
+        uint32_t home = way_index_home(index, set_tags[slots[i] - 1]);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole] = WAY_INDEX_EMPTY;
+}
+
+void way_index_release(struct way_index *index, uint32_t set_idx, uint32_t way)
+{
+    uint64_t *holes = &index->holes[(size_t)set_idx * index->hole_words];
+    holes[way / 64] |= UINT64_C(1) << (way % 64);
+    index->num_holes[set_idx]++;
+}
+
+void way_index_rebuild(struct way_index *index, const struct cache_system *cache_system)
+{
+    for (uint32_t set_idx = 0; set_idx < index->sets; set_idx++) {
+        const uint64_t *set_tags = cache_system_set_tags(cache_system, set_idx);
+
+        // Every invalid way below the last valid one is a hole.
+        uint32_t filled = index->associativity;
+        while (filled > 0 && set_tags[filled - 1] == CACHE_TAG_INVALID) filled--;
+        index->filled[set_idx] = filled;
+        for (uint32_t way = 0; way < filled; way++) {
+            if (set_tags[way] == CACHE_TAG_INVALID) {
+                way_index_release(index, set_idx, way);
+            } else {
+                way_index_insert(index, set_tags, set_idx, way);
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+//
+// This file defines the way index, a per-set hash table from tags to ways
+// that the cache system uses instead of searching the tags of a set when the
+// associativity is high.
+//
+// Every set has its own open-addressing table with linear probing. The table
+// stores way numbers rather than tags; the tags themselves stay in the cache
+// system's tag array, which the index reads to compare keys. Because the
+// tables of different sets never overlap, the set-partitioned parallel
+// simulation can update them from several threads at once.
+//
+
+#ifndef WAY_INDEX_H
+#define WAY_INDEX_H
+
+#include <stdint.h>
+
+struct cache_system;
+
+// Every array starts out zeroed, so the memory of the sets that are never
+// accessed is never touched.
+struct way_index {
+    uint32_t *slots;  // (capacity) slots per set; WAY_INDEX_EMPTY or a way + 1.
+    uint32_t *filled; // Per set: every way from this one on has never been filled.
+    uint64_t *holes;  // Per set: a bitmap of the invalidated ways below filled.
+    uint32_t *num_holes;
+    uint32_t sets, associativity;
+    uint32_t capacity, capacity_bits; // Per set; a power of two.
+    uint32_t hole_words;              // Per set.
+};
+
+#define WAY_INDEX_EMPTY 0
+
+struct way_index *way_index_new(uint32_t sets, uint32_t associativity);
+void way_index_cleanup(struct way_index *index);
+
+// Return the way in set_idx whose tag (in set_tags, the tags of that set) is
+// tag, or -1 if there is none. Passing CACHE_TAG_INVALID returns the first
+// invalid way. Until a line of the set is invalidated, that is simply the
+// first way that was never filled.
+int way_index_find(const struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                   uint64_t tag);
+
+// Add way, whose tag has already been stored in set_tags, to the index.
+void way_index_insert(struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                      uint32_t way);
+
+// Remove way from the index. Must be called while set_tags still holds the
+// tag of the way.
+void way_index_remove(struct way_index *index, const uint64_t *set_tags, uint32_t set_idx,
+                      uint32_t way);
+
+// Mark way, which has been removed from the index, as invalid.
+void way_index_release(struct way_index *index, uint32_t set_idx, uint32_t way);
+
+// Fill a new (empty) index from the tags of every set of cache_system, for
+// example after the tags were restored from a checkpoint.
+void way_index_rebuild(struct way_index *index, const struct cache_system *cache_system);
+
+#endif
@@ -0,0 +1,102 @@
+//
+// This file is a regression test for libcachesim, which "make check" links
+// against both libcachesim.a and libcachesim.so. It only uses the public
+// interface in libcachesim.h, so it fails to link when an export goes
+// missing, and it checks that the internal symbols stay hidden.
+//
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/libcachesim.h"
+
+#define NUM_ACCESSES 100
+
+static int failures = 0;
+
+static void expect(int condition, const char *what)
+{
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void expect_stats(const struct cachesim_stats *stats, uint64_t accesses, uint64_t hits,
+                         uint64_t misses, uint64_t dirty_evictions, const char *what)
+{
+    if (stats->accesses != accesses || stats->hits != hits || stats->misses != misses ||
+        stats->dirty_evictions != dirty_evictions) {
+        fprintf(stderr,
+                "FAIL: %s: %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 " accesses/hits/misses/"
+                "dirty evictions, expected %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n",
+                what, stats->accesses, stats->hits, stats->misses, stats->dirty_evictions,
+                accesses, hits, misses, dirty_evictions);
+        failures++;
+    }
+}
+
+static void count_diagnostic(void *data, const char *message)
+{
+    (void)message;
+    (*(int *)data)++;
+}
+
+int main(void)
+{
+    // Invalid caches are refused through the diagnostic callback.
+    int diagnostics = 0;
+    expect(cachesim_new("LRU", 100, 3, 1, 0, count_diagnostic, &diagnostics) == NULL,
+           "an invalid geometry is refused");
+    expect(cachesim_new("NOPE", 256, 4, 2, 0, count_diagnostic, &diagnostics) == NULL,
+           "an unknown policy is refused");
+    expect(diagnostics == 2, "every refusal is reported");
+
+    // Four 64-byte lines in two 2-way sets: cycling over four lines misses
+    // once on each and then always hits. Line 0 is written.
+    struct cachesim *sim = cachesim_new("LRU", 256, 4, 2, 0, NULL, NULL);
+    expect(sim != NULL, "a valid cache is created");
+    if (sim == NULL) return 1;
+
+    uint64_t addresses[NUM_ACCESSES];
+    uint8_t writes[NUM_ACCESSES];
+    for (int i = 0; i < NUM_ACCESSES; i++) {
+        addresses[i] = 64 * (i % 4) + i % 64;
+        writes[i] = i % 4 == 0;
+    }
+    struct cachesim_stats stats;
+    uint64_t hits[2], dirty_evictions[2];
+    memset(hits, 0xff, sizeof(hits));
+    memset(dirty_evictions, 0xff, sizeof(dirty_evictions));
+    expect(cachesim_access_batch(sim, addresses, writes, NUM_ACCESSES, &stats, hits,
+                                 dirty_evictions) == 0,
+           "the first batch is simulated");
+    expect_stats(&stats, NUM_ACCESSES, NUM_ACCESSES - 4, 4, 0, "the first batch");
+    expect(hits[0] == ~UINT64_C(0xf), "the first 64 accesses hit after the first four");
+    expect(hits[1] == (UINT64_C(1) << (NUM_ACCESSES - 64)) - 1, "the last accesses hit");
+    expect(dirty_evictions[0] == 0 && dirty_evictions[1] == 0, "nothing is evicted");
+
+    // Four new lines replace the old ones, and only the first evicts line 0,
+    // the one dirty line. Without writes, every access is a read.
+    uint64_t new_addresses[4] = {256, 320, 384, 448};
+    memset(hits, 0xff, sizeof(hits));
+    memset(dirty_evictions, 0, sizeof(dirty_evictions));
+    expect(cachesim_access_batch(sim, new_addresses, NULL, 4, &stats, hits, dirty_evictions) == 0,
+           "the second batch is simulated");
+    expect_stats(&stats, 4, 0, 4, 1, "the second batch");
+    expect(hits[0] == 0, "the new lines miss");
+    expect(dirty_evictions[0] == 1, "the first new line evicts the dirty line");
+
+    cachesim_get_stats(sim, &stats);
+    expect_stats(&stats, NUM_ACCESSES + 4, NUM_ACCESSES - 4, 8, 1, "the whole run");
+    cachesim_free(sim);
+
+    expect(dlsym(RTLD_DEFAULT, "cache_system_new") == NULL, "the cache system stays hidden");
+
+    if (failures == 0) printf("libcachesim: OK\n");
+    return failures != 0;
+}